@@ -4,25 +4,52 @@
  * This software is distributed under GPL. For details see LICENSE file.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
 #include <poll.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include <X11/Xlib.h>
-#include <X11/xpm.h>
+#include <X11/Xutil.h>
 #include <X11/Xatom.h>
 
 #include "asmem.h"
-#include "background.xpm"
-#include "alphabet.xpm"
+#include "atlas.h"
 
 #include "config.h"
 
+#if defined (HAVE_LIBXEXT) && defined (HAVE_X11_EXTENSIONS_XSHM_H) && defined (HAVE_SYS_SHM_H)
+# define USE_SHM
+# include <sys/ipc.h>
+# include <sys/shm.h>
+# include <X11/extensions/XShm.h>
+#endif
+
 // update frequency [ms]
 #define DEFAULT_INTERVAL 2000
 static int updateInterval_G = DEFAULT_INTERVAL;
@@ -30,18 +57,134 @@ static int updateInterval_G = DEFAULT_INTERVAL;
 #define STRSZ 32
 #define FNAMESZ 256
 #define WIDTH_PADDING 6
-#define MAXDIGITS 10
+
+// glyph cells in the alphabet (cells overlap by one background column)
+#define GLYPH_W 6
+#define GLYPH_H 9
+#define GLYPH_STEP 5
+#define GLYPH_BLANK -1		// no glyph, background shows through
+#define GLYPH_DIMZERO 10
+#define GLYPH_PERCENT 11
+#define GLYPH_SPACE 13
+#define GLYPH_ETA 16		// added to a glyph, draws it out of etaAlphabet_G
+
+// layout of the window (based on background.xpm), in unscaled pixels
+#define MEMTOTAL_Y 2
+#define MEMUSED_Y 17
+#define MEMBAR_Y 13
+#define SWPTOTAL_Y 27
+#define SWPUSED_Y 42
+#define SWPBAR_Y 38
+#define USED_X 2
+#define USED_CELLS 6		// keeps "used" clear of the percentage
+#define PCT_X 32
+#define PCT_CELLS 4
+#define BAR_X 3
+#define BAR_ROWS 3		// light, regular, dark
+#define GRAPH_X 2		// the history graph, below the total
+#define GRAPH_Y 12
+#define GRAPH_PADDING 3		// right and bottom frame
+#define SCALE_MAX 8		// --scale
+#define SCALE_DPI 96		// what --scale auto takes for 1
+
+// memory pressure (PSI) triggers
+#define PSI_SYSTEM "/proc/pressure/memory"
+#define PSI_TRIGGER "some 150000 2000000"	// 150ms of stall in a 2s window
+#define PSI_MAXFDS 2		// system-wide + our cgroup
+#define PSI_BACKOFF 10		// periodic interval multiplier while calm
+#define PSI_HOT_TICKS 5		// ticks at the normal rate after an event
+#define PSI_MAX_INTERVAL 60000	// [ms]
+
+// headless output
+#define OUTPUT_BUFSZ 65536	// samples are collected here between writes
+#define OUTPUT_RECSZ 4096	// room for one formatted sample, --trend columns included
+#define fmtCSV 0
+#define fmtJSON 1
+#define fmtBINARY 2
+
+// cgroup v2
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_RESCAN 10	// ticks between looking for the top cgroup
+#define CGROUP_MAXDEPTH 6	// how deep to look for it
+#define cgCURRENT 0
+#define cgMAX 1
+#define cgSTAT 2
+#define cgSWAPCURRENT 3
+#define cgSWAPMAX 4
+#define cgEVENTS 5
+#define cgCOUNT 6
+
+// NUMA nodes
+#define NUMA_SYSFS "/sys/devices/system/node"
+#define NUMA_MAXNODES 16	// shown, the lowest numbered ones
+
+// swap devices
+#define SWAPS_PROC "/proc/swaps"
+#define SWAPS_ZSWAP "/sys/kernel/debug/zswap"	// for kernels without Zswap in meminfo, root only
+#define SWAPS_MAXDEVS 32	// MAX_SWAPFILES
+
+// top processes
+#define TOP_ROWS 3		// processes shown
+#define TOP_ROW_H 10		// [pixels]
+#define TOP_SWPBAR_Y 17		// the swap bar moves up under the memory bar
+#define TOP_Y 21		// the first process
+#define TOP_MAXPROCS 131072	// processes tracked
+#define TOP_WORKERS 4		// threads reading statm files, the main one included
+
+// agent/viewer
+#define NET_MAXNODES 256	// streams a viewer follows, clients an agent serves
+#define NET_RETRY 5000		// reconnect delay [ms]
+
+// metrics exporter
+#define METRICS_MAXCLIENTS 16	// scrapes served at once
+#define METRICS_BUFSZ 65536	// a rendered response
+#define METRICS_HEADSZ 160	// room for the HTTP header in front of the body
+#define METRICS_ROOM 2048	// for a family's header, histogram or sample line
+#define METRICS_TIMEOUT 5000	// [ms] a scrape may take
+
+// shared memory
+#define SHM_SPINS 1000		// yields before giving up on a half-written sample
+#define SHM_STALE 2		// publisher's intervals without a sample before it's given up on
+
+// alerts
+#define ALERT_MAX 16		// --alert rules
+#define ALERT_DEBOUNCE 2	// samples a rule has to agree on before it flips
+#define ALERT_HYST_DIV 10	// it's off again 1/10 of the limit short of it
+#define alAVAIL 0		// free + buffers + cache [% of total]
+#define alUSED 1		// the rest [% of total]
+#define alSWAP 2		// used swap [% of swap]
+#define alGROWTH 3		// used [MB/s]
+#define alCOUNT 4
+
+// trends
+#define TREND_TAU 60		// [s] time constant of the averages
+#define TREND_SPAN 60		// [s] of a min/max bucket, TREND_BUCKETS of them are the window
+#define TREND_HORIZON 1440	// [min] the window counts down to exhaustion from here
+
+// recorder
+#define REC_BLOCKSZ 4096	// [bytes], a page
+#define REC_DEFAULT_SIZE 8	// [MB], about a week of 1s samples
+#define REC_QUEUE 64		// samples waiting for the recorder thread
+#define REC_MAXREC 255		// payload bytes a length byte can announce
+#define REC_MAX_SIZE 4096	// [MB]
+#define REC_ZIGZAG(v) (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define REC_UNZIGZAG(u) (((u) >> 1) ^ (0 - ((u) & 1)))
+
+// monitors
+#define MON_MAX 16		// windows (--dev files) per process
+
+// adaptive sampling
+#define ADAPT_MIN_DIV 4		// fastest interval is updateInterval/4
+#define ADAPT_MAX_MUL 4		// slowest interval is updateInterval*4
+#define ADAPT_FAST_PCT 1	// a change of >= 1% of memTotal is "fast"
+#define SLACK_DIV 20		// allow the kernel 5% of the period as timer slack
+#define NSEC_PER_SEC ((uint64_t)1000000000)
+#define NSEC_PER_MSEC ((uint64_t)1000000)
 
 #define VERBOSE(fmt, ...) \
 	if (verbose_G) { \
-		char *fname_p = basename (__FILE__); \
-		char *newfmt_p = (char*)malloc (strlen (fmt) + 32); \
-		if (newfmt_p) { \
-			strcpy (newfmt_p, "[%s:%s():%u] "); \
-			strcat (newfmt_p, fmt); \
-			fprintf (stderr, newfmt_p, fname_p, __func__, __LINE__, ##__VA_ARGS__); \
-			free (newfmt_p); \
-		} \
+		fprintf (stderr, "[%s:%s():%u] ", basename (__FILE__), __func__, __LINE__); \
+		fprintf (stderr, fmt, ##__VA_ARGS__); \
 	}
 
 /* ------------------------------------------------------------------------- */
@@ -55,37 +198,434 @@ static void parse_cmdline (int argc, char *argv[]);
 static char* safe_copy (char *dest_p, const char *src_p, size_t maxlen);
 static void cleanup (void);
 
+// monitors
+static bool monitor_add (const char *filename_p);
+static bool monitor_select (Window win);
+
 // file handling
-static unsigned long get_num (char *marker_p);
+static unsigned meminfo_hash (const char *key_p, size_t len);
+static void meminfo_build_index (const MeminfoKey_t *keys_p, unsigned nkeys, signed char *index_p);
+static const char* meminfo_parse_line (const MeminfoKey_t *keys_p, const signed char *index_p, const char *line_p, const char *end_p, AsmemMeminfo_t *info_p, unsigned *found_p);
+static ssize_t meminfo_snapshot (int fd);
+static unsigned meminfo_decode (const char *p, const char *end_p, AsmemMeminfo_t *info_p);
 static bool read_meminfo (void);
 static bool open_meminfo (void);
 static void close_meminfo (void);
-static void meminfo_update (void);
+static unsigned long meminfo_delta (const AsmemMeminfo_t *a_p, const AsmemMeminfo_t *b_p);
+static unsigned long meminfo_available (const AsmemMeminfo_t *info_p);
+static unsigned long meminfo_used (const AsmemMeminfo_t *info_p);
+static void meminfo_segments (const AsmemMeminfo_t *info_p, unsigned long *seg_p);
+static bool meminfo_set_bars (const char *list_p);
+static unsigned long meminfo_update (void);
+static unsigned long meminfo_update_monitor (void);
+static bool history_initialize (unsigned len);
+static void history_push (const AsmemMeminfo_t *info_p);
+static const AsmemMeminfo_t* history_get (unsigned age);
+static void cgroup_set_path (char *dest_p, const char *path_p);
+static bool cgroup_open (const char *path_p);
+static void cgroup_close (void);
+static bool cgroup_read_value (int fd, unsigned long *val_p);
+static void cgroup_read (AsmemMeminfo_t *info_p);
+static bool cgroup_check_events (void);
+static void cgroup_find_top (char *path_p, size_t len, unsigned depth, double *best_p, char *bestPath_p);
+static void cgroup_scan (void);
+static int numa_compare (const void *a_p, const void *b_p);
+static bool numa_initialize (void);
+static void numa_read (void);
+static void numa_cleanup (void);
+static const char* swaps_word (const char **p_p, const char *end_p, size_t *len_p);
+static unsigned long swaps_number (const char **p_p, const char *end_p);
+static bool swaps_open (void);
+static AsmemSwapDev_t* swaps_add_dev (const char *path_p, size_t len);
+static void swaps_read (const AsmemMeminfo_t *info_p);
+static void swaps_cleanup (void);
+
+// headless output
+static void output_quit (int sig);
+static bool output_open (void);
+static void output_close (void);
+static void output_flush (void);
+static char* output_ulong (char *p, unsigned long val);
+static char* output_rate (char *p, double rate);
+static void output_sample (const char *node_p, uint64_t time, const AsmemMeminfo_t *info_p, const AsmemTrends_t *trends_p);
+
+// top processes
+static bool top_initialize (void);
+static void* top_worker (void *arg_p);
+static int top_open (int pid);
+static void top_read_range (unsigned part);
+static void top_scan (void);
+static void top_cleanup (void);
+
+// agent/viewer
+static bool net_resolve (const char *addr_p, bool passive, struct sockaddr_storage *sa_p, socklen_t *len_p);
+static int net_listen (const char *addr_p);
+static void net_add_node (const char *addr_p);
+static void net_connect (AsmemNode_t *node_p);
+static void net_disconnect (AsmemNode_t *node_p);
+static void net_reconnect (uint64_t now);
+static uint64_t net_retry_time (void);
+static void net_publish (const AsmemMeminfo_t *info_p);
+static bool net_receive (AsmemNode_t *node_p);
+static nfds_t net_fill_pollfds (struct pollfd *fds_p);
+static void net_service (struct pollfd *fds_p, nfds_t nfds);
+static void net_cleanup (void);
+
+// metrics exporter
+static char* metrics_fixed (char *p, uint64_t val, unsigned decimals);
+static char* metrics_family (char *p, const char *name_p, const char *type_p, const char *unit_p);
+static char* metrics_label (char *p, const char *val_p);
+static char* metrics_hist (char *p, const AsmemHist_t *hist_p);
+static void metrics_render (void);
+static void metrics_drop (unsigned i);
+static void metrics_respond (AsmemScrape_t *scrape_p);
+static nfds_t metrics_fill_pollfds (struct pollfd *fds_p, uint64_t now);
+static uint64_t metrics_timeout (void);
+static void metrics_service (struct pollfd *fds_p, nfds_t nfds);
+static void metrics_cleanup (void);
+
+// shared memory
+static bool shm_publisher_open (void);
+static bool shm_subscriber_open (void);
+static void shm_publish (const AsmemMeminfo_t *info_p);
+static bool shm_read (AsmemMeminfo_t *info_p);
+static void* shm_waiter (void *arg_p);
+static bool shm_subscribed (void);
+static void shm_received (uint64_t now);
+static void shm_watch (uint64_t now);
+static void shm_lost (const char *why_p);
+static void shm_cleanup (void);
+
+// alerts
+static bool alert_add (const char *rule_p);
+static bool alert_helper_start (void);
+static void alert_helper (int fd);
+static bool alert_fifo_open (void);
+static void alert_check (void);
+static void alert_fire (unsigned rule, bool on, unsigned long value);
+static void alert_cleanup (void);
+
+// trends
+static void trend_update (AsmemTrends_t *trends_p, const AsmemMeminfo_t *info_p, uint64_t time);
+static void trend_range (const AsmemTrends_t *trends_p, unsigned series, unsigned long *min_p, unsigned long *max_p);
+
+// recorder
+static uint8_t rec_check (const uint8_t *p, size_t len);
+static uint8_t* rec_put_varint (uint8_t *p, uint64_t val);
+static bool rec_get_varint (const uint8_t **p_p, const uint8_t *end_p, uint64_t *val_p);
+static bool rec_open (void);
+static void rec_push (const AsmemMeminfo_t *info_p);
+static void* rec_writer (void *arg_p);
+static size_t rec_encode (const AsmemRecSample_t *sample_p, bool first, uint8_t *rec_p);
+static void rec_new_block (uint64_t time);
+static void rec_append (const AsmemRecSample_t *sample_p);
+static int rec_compare (const void *a_p, const void *b_p);
+static bool rec_decode_block (const AsmemRecHeader_t *header_p, const uint8_t *block_p, AsmemTrends_t *trends_p, unsigned long *cnt_p);
+static bool rec_replay (void);
+static void rec_cleanup (void);
+
+// self-instrumentation
+static void stats_request (int sig);
+static void stats_record (AsmemHist_t *hist_p, uint64_t ns);
+static unsigned long stats_written (void);
+static void stats_dump_hist (const AsmemHist_t *hist_p);
+static void stats_dump (void);
+
+// scheduling
+static uint64_t sched_now (void);
+static bool sched_sampling (void);
+static uint64_t sched_period (void);
+static uint64_t sched_next_deadline (uint64_t prev, uint64_t now);
+static void sched_adapt (unsigned long delta);
+
+// memory pressure
+static bool psi_get_cgroup (char *path_p, size_t len);
+static int psi_open_trigger (const char *path_p);
+static void psi_initialize (void);
+static void psi_cleanup (void);
 
 // x11
-static Pixel x11_get_colour (char *colourName_p, Window win);
-static XColor x11_parse_colour (char *colourName_p, Window win);
-static char* x11_darken_char_colour (char *colourName_p, double rate, Window win);
-static Pixel x11_darken_colour (char *colourName_p, double rate, Window win);
-static char* x11_lighten_char_colour (char *colourName_p, double rate, Window win);
-static Pixel x11_lighten_colour (char *colourName_p, double rate, Window win);
+static void x11_parse_colour (const char *colourName_p, XColor *colour_p);
+static XColor x11_darken_colour (XColor colour, unsigned rate);
+static XColor x11_lighten_colour (XColor colour, unsigned rate);
+static unsigned long x11_channel_bits (unsigned short value, unsigned long mask);
+static Pixel x11_get_pixel (XColor *colour_p);
+static bool x11_create_image (const unsigned char *bits_p, unsigned width, unsigned height, XColor *palette_p, AsmemImage_t *image_p);
+static void x11_mark_dirty (int x, int y, int w, int h);
+static void x11_format_number (unsigned long val, signed char *cell_p, unsigned cells, bool msdFirst);
+static void x11_format_percent (unsigned long used, unsigned long total, signed char *cell_p);
+static unsigned x11_bar_width (unsigned long val, unsigned long total);
+static void x11_compose_frame (AsmemFrame_t *frame_p);
+static void x11_draw_text (unsigned field, const signed char *cell_p);
+static void x11_draw_bar (int y, const unsigned *colour_p, const unsigned *old_p, const unsigned *new_p, unsigned segments);
+static void x11_draw_peak (int y, const unsigned *colour_p, const unsigned *bar_p, unsigned segments, unsigned oldPeak, unsigned newPeak);
+static void x11_create_bar_strips (void);
+static void x11_blit_background (int x, int y, int w, int h);
+static void x11_blit_glyph (int glyph, int x, int y);
+static void x11_blit_bar (unsigned colour, int x, int y, int w);
+static void x11_blit_fill (Pixel pixel, int x, int y, int w, int h);
+static void x11_blit_scroll (int x, int y, int w, int h);
+static void x11_present (int x, int y, unsigned w, unsigned h);
+static void x11_draw_usage (int x, int top, int w, int h, const AsmemMeminfo_t *info_p);
+static void x11_draw_history (bool full);
+static void x11_draw_alert (void);
+static void x11_set_urgency (bool urgent);
+static void x11_draw_panel (bool full);
+static void x11_draw_numa (bool full);
 static void x11_draw_offscreen_win (void);
 static void x11_draw_main_win_from_offscreen (void);
+static void x11_redraw (void);
 static void x11_check_events (void);
+static void x11_layout (void);
+static void x11_initialize_colours (void);
+static void x11_initialize_frame (void);
+static void x11_create_windows (XSizeHints *hints_p, unsigned depth);
 static void x11_initialize (int argc, char *argv[]);
+static int x11_detect_scale (void);
+
+// client-side framebuffer
+static uint32_t* fb_decode_image (const AsmemImage_t *image_p);
+#ifdef USE_SHM
+static int fb_trap_error (Display *dpy_p, XErrorEvent *event_p);
+#endif
+static bool fb_create_image (unsigned w, unsigned h);
+static bool fb_initialize (void);
+static bool fb_initialize_memory (void);
+static void fb_initialize_snapshot (void);
+static void fb_cleanup (void);
+static void fb_blit (const uint32_t *src_p, int srcStride, int sx, int sy, int w, int h, int dx, int dy);
+static void fb_fill (uint32_t pixel, int x, int y, int w, int h);
+static void fb_scroll (int x, int y, int w, int h);
+static void fb_blit_background (int x, int y, int w, int h);
+static void fb_blit_glyph (int glyph, int x, int y);
+static void fb_blit_bar (unsigned colour, int x, int y, int w);
+static void fb_blit_fill (Pixel pixel, int x, int y, int w, int h);
+static void fb_put (Window win, int x, int y, unsigned w, unsigned h);
+static void fb_present (int x, int y, unsigned w, unsigned h);
+#ifdef USE_SHM
+static void fb_completed (void);
+#endif
+static void fb_write_ppm (int x, int y, unsigned w, unsigned h);
 
 /* ------------------------------------------------------------------------- */
 // globals
 /* ------------------------------------------------------------------------- */
-static AsmemMeminfo_t last_G;
-static AsmemMeminfo_t fresh_G;
 static char displayName_G[STRSZ];
 static char mainGeometry_G[STRSZ];
-static FILE *procMeminfoFile_pG = NULL;
-static char procMemFilename_G[FNAMESZ];
-static char tmpChar_G[STRSZ];
+static char *meminfoBuf_pG = NULL;
+static size_t meminfoBufSz_G = 0;
 static bool verbose_G = false;
-static bool visible_G = true;
+static bool psi_G = false;
+static int psiFd_G[PSI_MAXFDS];
+static unsigned psiFdCnt_G = 0;
+static unsigned psiHotTicks_G = 0;
+static bool adaptive_G = false;
+static int schedInterval_G = DEFAULT_INTERVAL;
+static uint64_t schedSlack_G = 0;
+
+/*
+ * Always-on counters and latency histograms of asmem itself, dumped to
+ * stderr on SIGUSR1 and, with --stats, at exit.
+ */
+static bool stats_G = false;
+static volatile sig_atomic_t statsRequested_G = 0;
+static unsigned long statsSamples_G = 0;
+static unsigned long statsRedraws_G = 0;
+static unsigned long statsSkipped_G = 0;	// the sample didn't change anything
+static unsigned long statsEmpty_G = 0;		// the redraw didn't change anything
+static unsigned long statsXEvents_G = 0;
+static unsigned long statsXRequests_G = 0;	// sent by the flushes
+static unsigned long statsXBytes_G = 0;
+static unsigned long statsXSerial_G = 0;	// the next request after the last flush
+static int statsIoFd_G = -1;			// the main thread's /proc/thread-self/io
+static AsmemHist_t statsRead_G = {.name_p = "read_meminfo"};
+static AsmemHist_t statsDraw_G = {.name_p = "draw"};
+static AsmemHist_t statsFlush_G = {.name_p = "flush"};
+static AsmemHist_t statsJitter_G = {.name_p = "tick lateness"};
+static AsmemHist_t statsTop_G = {.name_p = "top scan"};
+static AsmemHist_t *statsHists_G[] = {&statsRead_G, &statsDraw_G, &statsFlush_G, &statsJitter_G, &statsTop_G};
+
+/*
+ * With --headless no window is opened and every sample is formatted
+ * into outputBuf_G, which is written out every outputBatch_G samples.
+ */
+static bool headless_G = false;
+static int outputFormat_G = fmtCSV;
+static char outputFilename_G[FNAMESZ];
+static unsigned outputBatch_G = 1;
+static int outputFd_G = -1;
+static char outputBuf_G[OUTPUT_BUFSZ];
+static size_t outputLen_G = 0;
+static unsigned outputPending_G = 0;
+static volatile sig_atomic_t quit_G = 0;
+
+/*
+ * With --top the graph area lists the processes with the largest
+ * resident sets. Every process has an entry in topProcs_pG (sorted by
+ * PID, with its statm file kept open), topSpare_pG is where the next
+ * scan builds the new list.
+ */
+static bool top_G = false;
+static int topProcFd_G = -1;
+static DIR *topDir_pG = NULL;
+static AsmemProc_t *topProcs_pG = NULL;
+static AsmemProc_t *topSpare_pG = NULL;
+static unsigned topProcCnt_G = 0;
+static AsmemProc_t topList_G[TOP_ROWS];
+static unsigned topCnt_G = 0;
+static long topPageKb_G;
+static uint64_t topScanNs_G;
+static pthread_t topThreads_G[TOP_WORKERS - 1];
+static unsigned topThreadCnt_G = 0;
+static pthread_mutex_t topLock_G = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t topStart_G = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t topDone_G = PTHREAD_COND_INITIALIZER;
+static unsigned topRound_G = 0;
+static unsigned topBusy_G = 0;
+static bool topQuit_G = false;
+
+/*
+ * --agent publishes every sample to the clients of netListenFd_G,
+ * --view follows the agents in netNodes_pG (and shows them next to the
+ * local machine). All sockets are non-blocking and serviced from the
+ * main loop's ppoll().
+ */
+static char netHostname_G[STRSZ];
+static char netListenAddr_G[FNAMESZ];
+static int netListenFd_G = -1;
+static int netClientFd_G[NET_MAXNODES];
+static unsigned netClientCnt_G = 0;
+static AsmemNode_t *netNodes_pG = NULL;
+static unsigned netNodeCnt_G = 0;
+static bool netDirty_G = false;
+
+/*
+ * --metrics serves the latest sample and asmem's own counters in the
+ * OpenMetrics text format. metrics_render() builds the whole HTTP
+ * response once per sample, into whichever of the two buffers isn't
+ * current; a scrape is then answered from the main loop's ppoll() with
+ * a recv() and a send() straight out of the current one.
+ */
+static char metricsAddr_G[FNAMESZ];
+static int metricsListenFd_G = -1;
+static AsmemScrape_t metricsClients_G[METRICS_MAXCLIENTS];
+static unsigned metricsClientCnt_G = 0;
+static char metricsBuf_G[2][METRICS_BUFSZ];
+static const char *metricsResponse_pG[2];
+static size_t metricsLen_G[2];		// 0 until there's been a sample
+static unsigned metricsCur_G = 0;
+static unsigned long metricsScrapes_G = 0;
+
+/*
+ * --publish samples into an AsmemShm_t in a file (normally on /dev/shm)
+ * which any number of --subscribe viewers map read-only instead of
+ * reading /proc/meminfo themselves. A subscriber's waiter thread sleeps
+ * on the segment's futex and makes shmEventFd_G readable for ppoll().
+ * While the publisher is gone (shmStale_G), a subscriber reads
+ * /proc/meminfo itself until it's back.
+ */
+static char shmFilename_G[FNAMESZ];
+static bool shmPublish_G = false;
+static AsmemShm_t *shm_pG = NULL;
+static int shmFd_G = -1;
+static int shmEventFd_G = -1;
+static unsigned shmFieldCnt_G = 0;
+static bool shmStale_G = false;
+static uint64_t shmCheck_G = 0;		// when the publisher is checked on [ns, CLOCK_MONOTONIC]
+
+/*
+ * The --alert rules, checked against every sample of every monitor.
+ * What they do when they flip: mark the window urgent and flash its
+ * border, hand alertExec_G to the helper forked at startup (it's on the
+ * other end of alertHelperFd_G) and/or write a line to alertFifoFd_G.
+ */
+static AsmemAlert_t alerts_G[ALERT_MAX];
+static unsigned alertCnt_G = 0;
+static char alertExec_G[FNAMESZ];
+static char alertFifo_G[FNAMESZ];
+static int alertHelperFd_G = -1;
+static int alertFifoFd_G = -1;
+static unsigned long alertDropped_G = 0;	// the helper or fifo was full
+
+/*
+ * With --trend every monitor (and --replay) keeps running statistics of
+ * its samples, see trend_update(). They go out with the samples; the
+ * window marks the bars' peaks and counts down to running out of memory.
+ */
+static bool trend_G = false;
+static int panelCols_G, tileW_G, tileH_G;
+
+/*
+ * --record keeps the samples in a ring of compressed blocks in a mapped
+ * file. The main loop only queues them; the recorder thread encodes them
+ * into the mapping, so page faults and writeback stalls hit it instead.
+ * What doesn't fit into the queue is dropped and counted.
+ */
+static char recFilename_G[FNAMESZ];
+static char replayFilename_G[FNAMESZ];
+static unsigned recSize_G = REC_DEFAULT_SIZE;
+static int recFd_G = -1;
+static uint8_t *rec_pG = NULL;
+static size_t recMapSz_G = 0;
+static AsmemRecHeader_t *recHeader_pG = NULL;
+static unsigned recBlock_G = 0;		// the one being filled
+static uint64_t recSeq_G = 0;		// its seq
+static size_t recPos_G = REC_BLOCKSZ;	// where in it the next record goes
+static uint64_t recTime_G = 0;		// of the last record [ms]
+static uint64_t recLast_G[REC_MAXFIELDS];	// its values
+static AsmemRecSample_t recQueue_G[REC_QUEUE];
+static unsigned recHead_G = 0, recTail_G = 0;
+static pthread_t recThread_G;
+static bool recRunning_G = false;
+static bool recQuit_G = false;
+static pthread_mutex_t recLock_G = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t recWake_G = PTHREAD_COND_INITIALIZER;
+static unsigned long recDropped_G = 0;
+
+/*
+ * The last historyLen_G samples, oldest overwritten first. Sized once at
+ * startup (one entry per graph column) and never reallocated.
+ */
+static bool history_G = false;
+static unsigned historyLen_G = 0;
+static int graphW_G, graphH_G;
+static int swpBarY_G;		// where the swap bar is, --top moves it
+
+/*
+ * With --cgroup (or --cgroup-top, which keeps switching to whichever
+ * cgroup is closest to its memory.max) the numbers are the cgroup's,
+ * measured against its limits. memory.events is watched for high, max
+ * and oom events.
+ */
+static char cgroupPath_G[FNAMESZ];
+static char cgroupTopPath_G[FNAMESZ];
+static int cgroupFd_G[cgCOUNT] = {-1, -1, -1, -1, -1, -1};
+static unsigned long cgroupEvents_G = 0;
+static unsigned cgroupTicks_G = 0;
+
+/*
+ * With --numa the graph area shows a column per node and a bar with the
+ * share of the last tick's allocations which landed on a remote node.
+ */
+static bool numa_G = false;
+static AsmemNumaNode_t numaNodes_G[NUMA_MAXNODES];
+static unsigned numaNodeCnt_G = 0;
+static unsigned numaRemotePct_G = 0;
+static unsigned numaRemoteBar_G = 0;
+
+/*
+ * --swaps tells swap in compressed RAM (zram devices and zswap) from
+ * swap on disk. /proc/swaps, the zram devices' mm_stat and zswap's
+ * debugfs counters are kept open and read with every sample.
+ */
+static bool swaps_G = false;
+static int swapsFd_G = -1;
+static int swapsZswapFd_G[2] = {-1, -1};	// stored_pages, pool_total_size
+static long swapsPageSz_G;
+static AsmemSwapDev_t swapDevs_G[SWAPS_MAXDEVS];
+static unsigned swapDevCnt_G = 0;
+static unsigned long swapsSlow_G = 0, swapsFast_G = 0;	// used, on disk and in compressed RAM
+static unsigned long swapsOrig_G = 0, swapsCompr_G = 0;	// what's compressed, and the memory it takes
 
 static char bgColour_G[STRSZ];
 static char fgColour_G[STRSZ];
@@ -96,19 +636,25 @@ static char swapColour_G[STRSZ];
 
 static Display *dpy_pG = 0;
 static Window rootWin_G;
-static Window drawWin_G;
-static Window mainWin_G;
-static Window iconWin_G;
+static Colormap colormap_G;
+static Visual *visual_pG;
 static XGCValues mainGCV_G;
 static GC mainGC_G;
 static Atom wmDelWin_G;
 static Atom wmProtocols_G;
 static Pixel bgPix_G, fgPix_G;
 
-static char pgPixColour_G[4][STRSZ];
-static char alphaColour_G[4][STRSZ];
-static XpmIcon_t backgroundXpm_G;
-static XpmIcon_t alphabetXpm_G;
+/*
+ * Everything is laid out and drawn in the pixels of background.xpm. The
+ * images are rasterised scale_G times the size once, and the backends
+ * multiply the coordinates, so drawing scaled costs only bigger blits.
+ */
+static int scale_G = 1;
+static bool scaleAuto_G = false;
+
+static AsmemImage_t background_G;
+static AsmemImage_t alphabet_G;
+static AsmemImage_t etaAlphabet_G;	// in the swap colour, for --trend's countdown
 
 // first index, what the colour is for
 #define cMEM 0 // memory
@@ -121,6 +667,145 @@ static XpmIcon_t alphabetXpm_G;
 #define cDRK 2 // dark
 static Pixel pix_G[4][3];
 
+// text fields, the first index of AsmemFrame_t.glyph
+#define tMEMTOTAL 0
+#define tMEMUSED 1
+#define tMEMPCT 2
+#define tSWPTOTAL 3
+#define tSWPUSED 4
+#define tSWPPCT 5
+#define tTOPPID 6	// TOP_ROWS of them
+#define tTOPPCT 9	// TOP_ROWS of them
+#define tCOUNT 12
+typedef struct {
+	int x, y;		// position of the first cell
+	int step;		// distance to the next cell
+	unsigned cells;
+} TextField_t;
+static TextField_t textFields_G[tCOUNT];
+
+/*
+ * barsPix_G holds one BAR_ROWS high strip per bar colour; a bar segment
+ * is a single copy out of it.
+ */
+static Pixmap barsPix_G;
+
+/*
+ * Frames are drawn through one of the backends: xlib draws into the
+ * monitor's drawWin on the server, the others into its fbPixels_p in
+ * client memory. With --shm that's the data of its fbImage_p, which is
+ * pushed to the windows with one (Shm)PutImage each; with --snapshot
+ * there's no display and every frame is written out as a PPM image;
+ * memory leaves the frame where it is. The background and alphabet are
+ * expanded once into arrays of pixel values to blit from.
+ */
+static const AsmemBackend_t xlibBackend_G = {"xlib", x11_blit_background, x11_blit_glyph, x11_blit_bar, x11_blit_fill, x11_blit_scroll, x11_present};
+static const AsmemBackend_t shmBackend_G = {"shm", fb_blit_background, fb_blit_glyph, fb_blit_bar, fb_blit_fill, fb_scroll, fb_present};
+static const AsmemBackend_t memoryBackend_G = {"memory", fb_blit_background, fb_blit_glyph, fb_blit_bar, fb_blit_fill, fb_scroll, NULL};
+static AsmemBackend_t ppmBackend_G;	// memory, plus writing out the frames
+static const AsmemBackend_t *backend_pG = &xlibBackend_G;
+
+static bool framebuffer_G = false;
+static char snapshotFilename_G[FNAMESZ];
+static int fbWidth_G, fbHeight_G;
+static unsigned char *fbPpm_pG = NULL;
+static uint32_t *fbBackground_pG = NULL;
+static uint32_t *fbAlphabet_pG = NULL;
+static uint32_t *fbEtaAlphabet_pG = NULL;
+#ifdef USE_SHM
+static bool fbError_G = false;
+static int fbCompletion_G = -1;		// the ShmCompletion event type
+#endif
+
+/*
+ * Every --dev is watched by a monitor of its own: a source, its samples
+ * and a window (plus icon) showing them. The display, colours, images,
+ * layout and the main loop are shared by all of them. mon_pG is the one
+ * being sampled, drawn or handled at the moment.
+ */
+typedef struct {
+	char filename[FNAMESZ];
+	int meminfoFd;
+	AsmemMeminfo_t fresh, last;
+	bool sampled;
+	AsmemTrends_t trends;			// --trend
+
+	AsmemMeminfo_t *history_p;		// historyLen_G entries
+	unsigned historyHead, historyCnt;
+
+	// what has been drawn, so that only the parts which change are sent
+	AsmemFrame_t drawn;
+	bool drawnValid;
+	int dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+
+	Window mainWin, iconWin;
+	Pixmap drawWin;
+	bool mainMapped, iconMapped, visible;
+
+	uint32_t *fbPixels_p;
+	int fbStride;		// [pixels]
+	XImage *fbImage_p;
+	bool fbShm;
+#ifdef USE_SHM
+	XShmSegmentInfo fbShmInfo;
+	unsigned fbInFlight;	// XShmPutImage()s the server hasn't read yet
+	bool fbDeferred;	// a frame is waiting for them
+#endif
+
+	// the state of the --alert rules
+	uint32_t alertOn;		// bit per rule
+	unsigned char alertRun[ALERT_MAX];	// samples in a row it should flip
+	unsigned long alertUsed;	// for growth
+	uint64_t alertTime;
+	bool alertLit;			// the border is flashed on
+} AsmemMonitor_t;
+static AsmemMonitor_t monitors_G[MON_MAX];
+static unsigned monitorCnt_G = 0;
+static AsmemMonitor_t *mon_pG = &monitors_G[0];
+static bool visible_G = true;		// any of them
+
+/*
+ * The /proc/meminfo keys we care about and where their values go.
+ * Lines are dispatched through a small open-addressed hash index over
+ * this table, so neither the kernel's field order nor keys which share
+ * a suffix (e.g. "Cached" vs "SwapCached") matter.
+ */
+#define MEMINFO_KEY(member, key) {key, sizeof (key) - 1, offsetof (AsmemMeminfo_t, member)},
+static const MeminfoKey_t meminfoKeys_G[] = {
+	MEMINFO_FIELDS (MEMINFO_KEY)
+};
+#define MEMINFO_NKEYS (sizeof (meminfoKeys_G) / sizeof (meminfoKeys_G[0]))
+#define MEMINFO_HASHSZ 64	// power of two, comfortably > MEMINFO_NKEYS
+#define NET_SAMPLE_LEN (8 + MEMINFO_NKEYS * 4)	// what we send, at most 255
+#define REC_RECLEN ((2 + MEMINFO_NKEYS) * 10)	// longest --record payload, 10 bytes a varint
+_Static_assert (MEMINFO_NKEYS < 32 && MEMINFO_NKEYS <= SHM_MAXFIELDS && NET_SAMPLE_LEN <= 255 && REC_RECLEN <= REC_MAXREC,
+		"the found masks, the --publish segment, the NET_SAMPLE frame or a --record record can't take MEMINFO_FIELDS");
+
+/*
+ * What the numbers and bars make of the fields: --used avail counts
+ * MemTotal - MemAvailable as used rather than MemTotal - MemFree, --bars
+ * picks the fields of the memory bar's segments (by their offsets; none
+ * means used, buffers and cache).
+ */
+static bool usedAvail_G = false;
+static size_t barFields_G[3];
+static unsigned barFieldCnt_G = 0;
+#define MEMINFO_BUFSZ 4096	// initial read buffer size, grows if needed
+static signed char meminfoIndex_G[MEMINFO_HASHSZ];
+
+/*
+ * The same for the per-node files, whose lines read "Node <n> <key>: ...".
+ * They have no Buffers/Cached; FilePages (page cache incl. buffers) is
+ * shown as cache.
+ */
+static const MeminfoKey_t numaKeys_G[] = {
+	{"MemTotal", 8, offsetof (AsmemMeminfo_t, memTotal)},
+	{"MemFree", 7, offsetof (AsmemMeminfo_t, memFree)},
+	{"FilePages", 9, offsetof (AsmemMeminfo_t, memCached)},
+};
+#define NUMA_NKEYS (sizeof (numaKeys_G) / sizeof (numaKeys_G[0]))
+static signed char numaIndex_G[MEMINFO_HASHSZ];
+
 /* ------------------------------------------------------------------------- */
 // meat and potatoes
 /* ------------------------------------------------------------------------- */
@@ -128,44 +813,187 @@ int
 main (int argc, char *argv[])
 {
 	int xfd;
-	int timeout;
+	struct sigaction action;
 
 	atexit (cleanup);
 	set_defaults ();
 	parse_cmdline (argc, argv);
-	x11_initialize (argc, argv);
 
-	xfd = ConnectionNumber (dpy_pG);
+	// written out as the buffer fills up, not sample by sample
+	if (replayFilename_G[0] != 0) {
+		outputBatch_G = UINT_MAX;
+		exit (rec_replay () ? 0 : 1);
+	}
+
+	// forked while the process is still small and has no threads
+	if (alertExec_G[0] != 0 && !alert_helper_start ())
+		exit (1);
+	if (alertFifo_G[0] != 0 && !alert_fifo_open ())
+		exit (1);
+
+	// no SA_RESTART, ppoll() returns and the main loop does the dumping
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = stats_request;
+	sigaction (SIGUSR1, &action, NULL);
+
+	if (headless_G || snapshotFilename_G[0] != 0) {
+		// exit through cleanup(), which writes out what's pending
+		action.sa_handler = output_quit;
+		sigaction (SIGINT, &action, NULL);
+		sigaction (SIGTERM, &action, NULL);
+		signal (SIGPIPE, SIG_IGN);
+	}
+	if (recFilename_G[0] != 0 && !rec_open ())
+		exit (1);
+	if (metricsAddr_G[0] != 0 && (metricsListenFd_G = net_listen (metricsAddr_G)) == -1)
+		exit (1);
+	if (swaps_G && !swaps_open ())
+		exit (1);
+
+	if (headless_G) {
+		if (!open_meminfo ())
+			exit (1);
+		if (cgroupPath_G[0] != 0 && !cgroup_open (cgroupPath_G))
+			exit (1);
+		if (netListenAddr_G[0] != 0 && (netListenFd_G = net_listen (netListenAddr_G)) == -1)
+			exit (1);
+		if (shmPublish_G && !shm_publisher_open ())
+			exit (1);
+		if (((netListenAddr_G[0] == 0 && !shmPublish_G && metricsAddr_G[0] == 0) || outputFilename_G[0] != 0) && !output_open ())
+			exit (1);
+		xfd = -1;
+	}
+	else if (snapshotFilename_G[0] != 0) {
+		fb_initialize_snapshot ();
+		xfd = -1;
+	}
+	else {
+		x11_initialize (argc, argv);
+		xfd = ConnectionNumber (dpy_pG);
+	}
+	if (psi_G)
+		psi_initialize ();
+
 	if (xfd == 0) {
 		printf ("warning: can't obtain connection number, redraws timed with updates\n");
 		while (1) {
 			meminfo_update ();
 			usleep ((useconds_t)updateInterval_G * 1000);
+			if (statsRequested_G) {
+				statsRequested_G = 0;
+				stats_dump ();
+			}
 		}
 	}
 	else {
 		int rtn;
-		struct pollfd fds[1];
+		unsigned i;
+		nfds_t nfds, psiEnd, cgroupIdx, shmIdx, metricsIdx;
+		bool pressure;
+		uint64_t now, deadline, wake, events;
+		struct timespec timeout;
+		struct pollfd fds[1 + PSI_MAXFDS + 1 + 1 + 1 + NET_MAXNODES + 1 + METRICS_MAXCLIENTS];
 
 		memset (fds, 0, sizeof (fds));
 		fds[0].fd = xfd;
 		fds[0].events = POLLIN;
+		psiEnd = 1;
+		for (i=0; i<psiFdCnt_G; ++i) {
+			fds[psiEnd].fd = psiFd_G[i];
+			fds[psiEnd].events = POLLPRI;
+			++psiEnd;
+		}
+		cgroupIdx = psiEnd;
+		fds[cgroupIdx].events = POLLPRI;
+		shmIdx = cgroupIdx + 1;
+		fds[shmIdx].fd = shmEventFd_G;
+		fds[shmIdx].events = POLLIN;
 
+		/*
+		 * Samples are taken on absolute deadlines so that X events
+		 * (which wake us up) can't push the sampling cadence around.
+		 * A subscriber has no deadlines, it samples when the publisher
+		 * has a new sample, unless the publisher has gone quiet.
+		 */
+		schedInterval_G = updateInterval_G;
+		deadline = sched_next_deadline (0, sched_now ());
 		while (1) {
-			timeout = updateInterval_G;
-			if (!visible_G)
-				timeout = -1;
+			now = sched_now ();
+			if (shm_subscribed ())
+				shm_watch (now);
+			if (sched_sampling () && !shm_subscribed () && now >= deadline) {
+				stats_record (&statsJitter_G, now - deadline);
+				if (psiHotTicks_G)
+					--psiHotTicks_G;
+				sched_adapt (meminfo_update ());
+				deadline = sched_next_deadline (deadline, sched_now ());
+				continue;
+			}
+
+			// the sockets come and go, so their part is rebuilt every time
+			net_reconnect (now);
+			fds[cgroupIdx].fd = cgroupFd_G[cgEVENTS];	// --cgroup-top may have moved
+			metricsIdx = shmIdx + 1 + net_fill_pollfds (&fds[shmIdx + 1]);
+			nfds = metricsIdx + metrics_fill_pollfds (&fds[metricsIdx], now);
 
-			rtn = poll (fds, 1, timeout);
+			// the next sample, check on the publisher, reconnect or scrape to time out, whichever comes first
+			wake = sched_sampling () && !shm_subscribed () ? deadline : UINT64_MAX;
+			if (shm_subscribed () && shmCheck_G < wake)
+				wake = shmCheck_G;
+			if (net_retry_time () < wake)
+				wake = net_retry_time ();
+			if (metrics_timeout () < wake)
+				wake = metrics_timeout ();
+			if (wake < now)
+				wake = now;
+			timeout.tv_sec = (time_t)((wake - now) / NSEC_PER_SEC);
+			timeout.tv_nsec = (long)((wake - now) % NSEC_PER_SEC);
+			rtn = ppoll (fds, nfds, wake != UINT64_MAX ? &timeout : NULL, NULL);
+			if (quit_G)
+				exit (0);
+			if (statsRequested_G) {
+				statsRequested_G = 0;
+				stats_dump ();
+			}
 			if (rtn == -1) {
-				perror ("poll()");
+				if (errno != EINTR)
+					perror ("ppoll()");
 				continue;
 			}
-			if (rtn == 0) {
-				meminfo_update ();
+			if (rtn == 0)
 				continue;
+
+			pressure = false;
+			for (i=1; i<psiEnd; ++i) {
+				if (fds[i].revents & POLLERR) {
+					// the monitored cgroup went away
+					VERBOSE ("psi trigger %u gone\n", i);
+					fds[i].fd = -1;
+				}
+				else if (fds[i].revents & POLLPRI)
+					pressure = true;
+			}
+			// kernfs flags a changed memory.events with POLLERR|POLLPRI
+			if (fds[cgroupIdx].revents && cgroup_check_events ())
+				pressure = true;
+			if (pressure) {
+				VERBOSE ("memory pressure event\n");
+				psiHotTicks_G = PSI_HOT_TICKS;
+				sched_adapt (meminfo_update ());
+				deadline = sched_next_deadline (sched_now (), sched_now ());
+			}
+
+			if (fds[shmIdx].revents && read (shmEventFd_G, &events, sizeof (events)) > 0) {
+				shm_received (sched_now ());
+				if (sched_sampling ())
+					meminfo_update ();
 			}
-			x11_check_events ();
+
+			net_service (&fds[shmIdx + 1], metricsIdx - shmIdx - 1);
+			metrics_service (&fds[metricsIdx], nfds - metricsIdx);
+
+			if (fds[0].revents)
+				x11_check_events ();
 		}
 	}
 
@@ -179,8 +1007,21 @@ main (int argc, char *argv[])
 static void
 set_defaults (void)
 {
-	safe_copy (procMemFilename_G, PROC_MEM, sizeof (procMemFilename_G));
+	monitorCnt_G = 0;
+	monitor_add (PROC_MEM);
 	safe_copy (displayName_G, "", sizeof (displayName_G));
+	safe_copy (outputFilename_G, "", sizeof (outputFilename_G));
+	safe_copy (snapshotFilename_G, "", sizeof (snapshotFilename_G));
+	safe_copy (shmFilename_G, "", sizeof (shmFilename_G));
+	safe_copy (alertExec_G, "", sizeof (alertExec_G));
+	safe_copy (alertFifo_G, "", sizeof (alertFifo_G));
+	safe_copy (recFilename_G, "", sizeof (recFilename_G));
+	safe_copy (replayFilename_G, "", sizeof (replayFilename_G));
+	safe_copy (netListenAddr_G, "", sizeof (netListenAddr_G));
+	safe_copy (metricsAddr_G, "", sizeof (metricsAddr_G));
+	if (gethostname (netHostname_G, sizeof (netHostname_G)) == -1)
+		safe_copy (netHostname_G, "localhost", sizeof (netHostname_G));
+	netHostname_G[sizeof (netHostname_G) - 1] = 0;
 	safe_copy (mainGeometry_G, "", sizeof (mainGeometry_G));
 	safe_copy (bgColour_G, "#303030", sizeof (bgColour_G));
 	safe_copy (fgColour_G, "#20b2aa", sizeof (fgColour_G));
@@ -200,7 +1041,37 @@ print_usage (void)
 	printf ("-u | --update <secs>       the update interval in seconds\n");
 	printf ("--display <name>           the name of the display to use\n");
 	printf ("--position <xy>            position on the screen (geometry)\n");
-	printf ("--dev <device>             use the specified file as stat device\n");
+	printf ("--dev <device>             use the specified file as stat device (repeatable)\n");
+	printf ("--psi                      resample on memory pressure, poll less when calm\n");
+	printf ("--adaptive                 sample faster while values change, slower when flat\n");
+	printf ("--shm                      render client-side, upload with MIT-SHM if possible\n");
+	printf ("--scale <n|auto>           draw n times the size, or as Xft.dpi suggests\n");
+	printf ("--snapshot <file>          no window, write every frame to file as a PPM image\n");
+	printf ("--history                  show a scrolling graph instead of the bars\n");
+	printf ("--used <free|avail>        count as used what isn't free, or isn't available\n");
+	printf ("--bars <field,...>         the meminfo fields the memory bar shows (up to 3)\n");
+	printf ("--numa                     show a column per NUMA node and remote allocations\n");
+	printf ("--top                      list the processes using the most memory\n");
+	printf ("--stats                    print asmem's own counters and timings at exit\n");
+	printf ("--cgroup <path>            show a cgroup v2 group against its limits\n");
+	printf ("--cgroup-top <path>        show the group below path closest to its limit\n");
+	printf ("--headless                 no window, write samples to stdout\n");
+	printf ("--output <file>            with --headless, append samples to file\n");
+	printf ("--format <csv|json|binary> with --headless, the sample format (csv)\n");
+	printf ("--batch <n>                with --headless, write out every n samples\n");
+	printf ("--agent <addr>             no window, publish samples on a socket\n");
+	printf ("--view <addr>              show the node publishing on addr (repeatable)\n");
+	printf ("--metrics <addr>           serve the latest sample in OpenMetrics format on addr\n");
+	printf ("--trend                    track averages, peaks, growth and time until memory runs out\n");
+	printf ("--swaps                    split swap into compressed RAM (zram, zswap) and disk\n");
+	printf ("--publish <file>           no window, share every sample through file\n");
+	printf ("--subscribe <file>         show the samples shared through file\n");
+	printf ("--alert <rule>             e.g. avail<5%%, swap>50%%, growth>100 (repeatable)\n");
+	printf ("--alert-exec <command>     run command when an alert goes on or off\n");
+	printf ("--alert-fifo <file>        write a line to file when an alert goes on or off\n");
+	printf ("--record <file>            keep the samples in a ring in file\n");
+	printf ("--record-size <MB>         the size of a new --record file (%d)\n", REC_DEFAULT_SIZE);
+	printf ("--replay <file>            write out the samples recorded in file, and exit\n");
 	printf ("--bg <colour>              background colour\n");
 	printf ("--fg <colour>              base foreground colour\n");
 	printf ("--memory <colour>          used memory bar colour\n");
@@ -233,8 +1104,39 @@ parse_cmdline (int argc, char *argv[])
 		{"buffer", required_argument, NULL, 6},
 		{"cache", required_argument, NULL, 7},
 		{"swap", required_argument, NULL, 8},
+		{"psi", no_argument, NULL, 9},
+		{"adaptive", no_argument, NULL, 10},
+		{"shm", no_argument, NULL, 11},
+		{"history", no_argument, NULL, 12},
+		{"headless", no_argument, NULL, 13},
+		{"output", required_argument, NULL, 14},
+		{"format", required_argument, NULL, 15},
+		{"batch", required_argument, NULL, 16},
+		{"agent", required_argument, NULL, 17},
+		{"view", required_argument, NULL, 18},
+		{"numa", no_argument, NULL, 19},
+		{"cgroup", required_argument, NULL, 20},
+		{"cgroup-top", required_argument, NULL, 21},
+		{"top", no_argument, NULL, 22},
+		{"stats", no_argument, NULL, 23},
+		{"snapshot", required_argument, NULL, 24},
+		{"publish", required_argument, NULL, 25},
+		{"subscribe", required_argument, NULL, 26},
+		{"alert", required_argument, NULL, 27},
+		{"alert-exec", required_argument, NULL, 28},
+		{"alert-fifo", required_argument, NULL, 29},
+		{"used", required_argument, NULL, 30},
+		{"bars", required_argument, NULL, 31},
+		{"scale", required_argument, NULL, 32},
+		{"record", required_argument, NULL, 33},
+		{"record-size", required_argument, NULL, 34},
+		{"replay", required_argument, NULL, 35},
+		{"metrics", required_argument, NULL, 36},
+		{"trend", no_argument, NULL, 37},
+		{"swaps", no_argument, NULL, 38},
 		{NULL, 0, NULL, 0},
 	};
+	bool devGiven = false;
 
 	while (1) {
 		int c;
@@ -272,7 +1174,14 @@ parse_cmdline (int argc, char *argv[])
 				break;
 
 			case 2:
-				safe_copy (procMemFilename_G, optarg, sizeof (procMemFilename_G));
+				// the first one replaces /proc/meminfo, the others add monitors
+				if (!devGiven)
+					safe_copy (monitors_G[0].filename, optarg, sizeof (monitors_G[0].filename));
+				else if (!monitor_add (optarg)) {
+					printf ("asmem: at most %d --dev files\n", MON_MAX);
+					exit (1);
+				}
+				devGiven = true;
 				break;
 
 			case 3:
@@ -298,8 +1207,195 @@ parse_cmdline (int argc, char *argv[])
 			case 8:
 				safe_copy (swapColour_G, optarg, sizeof (swapColour_G));
 				break;
+
+			case 9:
+				psi_G = true;
+				break;
+
+			case 10:
+				adaptive_G = true;
+				break;
+
+			case 11:
+				framebuffer_G = true;
+				break;
+
+			case 12:
+				history_G = true;
+				break;
+
+			case 13:
+				headless_G = true;
+				break;
+
+			case 14:
+				safe_copy (outputFilename_G, optarg, sizeof (outputFilename_G));
+				break;
+
+			case 15:
+				if (strcmp (optarg, "csv") == 0)
+					outputFormat_G = fmtCSV;
+				else if (strcmp (optarg, "json") == 0)
+					outputFormat_G = fmtJSON;
+				else if (strcmp (optarg, "binary") == 0)
+					outputFormat_G = fmtBINARY;
+				else {
+					printf ("asmem: unknown format %s\n", optarg);
+					exit (1);
+				}
+				break;
+
+			case 16:
+				outputBatch_G = (unsigned)atoi (optarg);
+				if (outputBatch_G < 1)
+					outputBatch_G = 1;
+				break;
+
+			case 17:
+				safe_copy (netListenAddr_G, optarg, sizeof (netListenAddr_G));
+				headless_G = true;
+				break;
+
+			case 18:
+				net_add_node (optarg);
+				break;
+
+			case 19:
+				numa_G = true;
+				break;
+
+			case 20:
+				cgroup_set_path (cgroupPath_G, optarg);
+				break;
+
+			case 21:
+				cgroup_set_path (cgroupTopPath_G, optarg);
+				break;
+
+			case 22:
+				top_G = true;
+				break;
+
+			case 23:
+				stats_G = true;
+				break;
+
+			case 24:
+				safe_copy (snapshotFilename_G, optarg, sizeof (snapshotFilename_G));
+				break;
+
+			case 25:
+				safe_copy (shmFilename_G, optarg, sizeof (shmFilename_G));
+				shmPublish_G = true;
+				headless_G = true;
+				break;
+
+			case 26:
+				safe_copy (shmFilename_G, optarg, sizeof (shmFilename_G));
+				shmPublish_G = false;
+				break;
+
+			case 27:
+				if (!alert_add (optarg))
+					exit (1);
+				break;
+
+			case 28:
+				safe_copy (alertExec_G, optarg, sizeof (alertExec_G));
+				break;
+
+			case 29:
+				safe_copy (alertFifo_G, optarg, sizeof (alertFifo_G));
+				break;
+
+			case 30:
+				if (strcmp (optarg, "free") == 0)
+					usedAvail_G = false;
+				else if (strcmp (optarg, "avail") == 0)
+					usedAvail_G = true;
+				else {
+					printf ("asmem: --used is free or avail, not %s\n", optarg);
+					exit (1);
+				}
+				break;
+
+			case 31:
+				if (!meminfo_set_bars (optarg))
+					exit (1);
+				break;
+
+			case 32:
+				scaleAuto_G = (strcmp (optarg, "auto") == 0);
+				scale_G = scaleAuto_G ? 1 : atoi (optarg);
+				if (scale_G < 1 || scale_G > SCALE_MAX) {
+					printf ("asmem: --scale is auto or 1 to %d\n", SCALE_MAX);
+					exit (1);
+				}
+				break;
+
+			case 33:
+				safe_copy (recFilename_G, optarg, sizeof (recFilename_G));
+				break;
+
+			case 34:
+				recSize_G = (unsigned)atoi (optarg);
+				if (recSize_G < 1 || recSize_G > REC_MAX_SIZE) {
+					printf ("asmem: --record-size is 1 to %d MB\n", REC_MAX_SIZE);
+					exit (1);
+				}
+				break;
+
+			case 35:
+				safe_copy (replayFilename_G, optarg, sizeof (replayFilename_G));
+				break;
+
+			case 36:
+				safe_copy (metricsAddr_G, optarg, sizeof (metricsAddr_G));
+				break;
+
+			case 37:
+				trend_G = true;
+				break;
+
+			case 38:
+				swaps_G = true;
+				break;
 		}
 	}
+
+	if (netNodeCnt_G && headless_G && outputFormat_G == fmtBINARY) {
+		printf ("asmem: binary records have no room for node names, use csv or json with --view\n");
+		exit (1);
+	}
+	if (headless_G && snapshotFilename_G[0] != 0) {
+		printf ("asmem: --snapshot draws frames, --headless, --agent and --publish don't\n");
+		exit (1);
+	}
+	if (headless_G && numa_G) {
+		printf ("asmem: --numa draws the nodes, --headless, --agent and --publish don't\n");
+		exit (1);
+	}
+	if (headless_G && top_G) {
+		printf ("asmem: --top draws the processes, --headless, --agent and --publish don't\n");
+		exit (1);
+	}
+	if (top_G && (history_G || netNodeCnt_G || numa_G)) {
+		printf ("asmem: --top takes the graph's place, it can't be combined with --history, --view or --numa\n");
+		exit (1);
+	}
+	if (monitorCnt_G > 1 && (headless_G || snapshotFilename_G[0] != 0 || netNodeCnt_G || numa_G || top_G
+			|| cgroupPath_G[0] != 0 || cgroupTopPath_G[0] != 0)) {
+		printf ("asmem: several --dev files can only be shown as bars or with --history\n");
+		exit (1);
+	}
+	if (monitorCnt_G > 1 && (shmFilename_G[0] != 0 || recFilename_G[0] != 0 || swaps_G)) {
+		printf ("asmem: --publish, --subscribe, --record and --swaps work with a single --dev file\n");
+		exit (1);
+	}
+	if (swaps_G && (cgroupPath_G[0] != 0 || cgroupTopPath_G[0] != 0)) {
+		printf ("asmem: --swaps shows the machine's swap devices, not a cgroup's\n");
+		exit (1);
+	}
 }
 
 /*
@@ -316,348 +1412,4150 @@ safe_copy (char *dest_p, const char *src_p, size_t maxlen)
 static void
 cleanup (void)
 {
+	static bool done = false;
+
+	// called before some of the exit()s, and then again through atexit()
+	if (done)
+		return;
+	done = true;
+	if (stats_G)
+		stats_dump ();
+	fb_cleanup ();
 	if (dpy_pG) {
 		XCloseDisplay (dpy_pG);
 		XFree (dpy_pG);
 	}
+	if (statsIoFd_G != -1)
+		close (statsIoFd_G);
+	output_close ();
+	net_cleanup ();
+	metrics_cleanup ();
+	shm_cleanup ();
+	rec_cleanup ();
+	alert_cleanup ();
 	close_meminfo ();
+	psi_cleanup ();
+	numa_cleanup ();
+	swaps_cleanup ();
+	cgroup_close ();
+	top_cleanup ();
+	for (mon_pG=monitors_G; mon_pG<monitors_G+monitorCnt_G; ++mon_pG) {
+		free (mon_pG->history_p);
+		mon_pG->history_p = NULL;
+	}
+	mon_pG = &monitors_G[0];
 }
 
 /* ------------------------------------------------------------------------- */
-// file routines
+// monitors
 /* ------------------------------------------------------------------------- */
-static unsigned long
-get_num (char *marker_p)
+static bool
+monitor_add (const char *filename_p)
 {
-	char buf[255];
-	unsigned long val;
-
-	while (true) {
-		if (fgets (buf, sizeof (buf), procMeminfoFile_pG) == NULL) {
-			perror ("fgets()");
-			return (unsigned long)-1;
-		}
-
-		if (strstr (buf, marker_p)) {
-			sscanf (buf, "%*s %lu %*s\n", &val);
-			VERBOSE ("get_num() marker_p:%s val:%lu\n", marker_p, val);
-			return val;
-		}
-	}
+	AsmemMonitor_t *mon_p;
 
-	return (unsigned long)-1;
+	if (monitorCnt_G == MON_MAX)
+		return false;
+	mon_p = &monitors_G[monitorCnt_G++];
+	memset (mon_p, 0, sizeof (*mon_p));
+	safe_copy (mon_p->filename, filename_p, sizeof (mon_p->filename));
+	mon_p->meminfoFd = -1;
+	mon_p->mainMapped = true;
+	mon_p->visible = true;
+	return true;
 }
 
+/* makes the monitor win belongs to the current one */
 static bool
-read_meminfo (void)
+monitor_select (Window win)
 {
-	int result;
+	unsigned i;
 
-	fflush (procMeminfoFile_pG);
-
-	result = fseek (procMeminfoFile_pG, 0L, SEEK_SET);
-	if (result < 0) {
-		perror ("fseek()");
-		return false;
-	}
-
-	fresh_G.memTotal = get_num ("MemTotal") / 1000;
-	fresh_G.memFree = get_num ("MemFree") / 1000;
-	fresh_G.memBuffers = get_num ("Buffers") / 1000;
-	fresh_G.memCached = get_num ("Cached") / 1000;
-	fresh_G.swapTotal = get_num ("SwapTotal") / 1000;
-	fresh_G.swapFree = get_num ("SwapFree") / 1000;
-
-	return true;
+	for (i=0; i<monitorCnt_G; ++i)
+		if (monitors_G[i].mainWin == win || monitors_G[i].iconWin == win) {
+			mon_pG = &monitors_G[i];
+			return true;
+		}
+	return false;
 }
 
-static bool
-open_meminfo (void)
+/* ------------------------------------------------------------------------- */
+// file routines
+/* ------------------------------------------------------------------------- */
+/* FNV-1a over the key bytes */
+static unsigned
+meminfo_hash (const char *key_p, size_t len)
 {
-	if ((procMeminfoFile_pG = fopen (procMemFilename_G, "r")) == NULL) {
-		perror ("fopen()");
-		return false;
+	unsigned hash = 2166136261u;
+	size_t i;
+
+	for (i=0; i<len; ++i) {
+		hash ^= (unsigned char)key_p[i];
+		hash *= 16777619u;
 	}
-	return true;
+	return hash & (MEMINFO_HASHSZ - 1);
 }
 
 static void
-close_meminfo (void)
+meminfo_build_index (const MeminfoKey_t *keys_p, unsigned nkeys, signed char *index_p)
 {
-	fclose (procMeminfoFile_pG);
+	unsigned i, slot;
+
+	memset (index_p, -1, MEMINFO_HASHSZ);
+	for (i=0; i<nkeys; ++i) {
+		slot = meminfo_hash (keys_p[i].key_p, keys_p[i].len);
+		while (index_p[slot] != -1)
+			slot = (slot + 1) & (MEMINFO_HASHSZ - 1);
+		index_p[slot] = (signed char)i;
+	}
 }
 
-static void
-meminfo_update (void)
+/*
+ * Decodes one "Key:   value kB" line (or "Node <n> Key: value kB") starting
+ * at line_p. If the key is one of keys_p its value is stored in info_p and
+ * its bit is set in found_p. Returns a pointer to the start of the next line.
+ */
+static const char*
+meminfo_parse_line (const MeminfoKey_t *keys_p, const signed char *index_p, const char *line_p, const char *end_p, AsmemMeminfo_t *info_p, unsigned *found_p)
 {
-	static bool firstTime = true;
-	bool different;
+	const char *p;
+	const MeminfoKey_t *key_p;
+	unsigned long val;
+	unsigned slot;
+	int idx;
 
-	if (!read_meminfo ()) {
-		cleanup ();
-		exit (1);
+	if (end_p - line_p > 5 && memcmp (line_p, "Node ", 5) == 0) {
+		for (line_p+=5; line_p < end_p && *line_p >= '0' && *line_p <= '9'; ++line_p)
+			;
+		while (line_p < end_p && *line_p == ' ')
+			++line_p;
 	}
 
-	if (firstTime) {
-		firstTime = false;
-		different = true;
-	}
-	else
-		different = memcmp (&last_G, &fresh_G, sizeof (AsmemMeminfo_t));
+	p = line_p;
+	while (p < end_p && *p != ':' && *p != '\n')
+		++p;
+	if (p >= end_p || *p != ':')
+		goto next;
 
-	if (different) {
-		memcpy (&last_G, &fresh_G, sizeof (AsmemMeminfo_t));
-		x11_draw_offscreen_win ();
-		x11_draw_main_win_from_offscreen ();
+	slot = meminfo_hash (line_p, (size_t)(p - line_p));
+	while ((idx = index_p[slot]) != -1) {
+		key_p = &keys_p[idx];
+		if (key_p->len == (size_t)(p - line_p) && memcmp (key_p->key_p, line_p, key_p->len) == 0)
+			break;
+		slot = (slot + 1) & (MEMINFO_HASHSZ - 1);
 	}
-}
+	if (idx == -1)
+		goto next;
+
+	for (++p; p < end_p && *p == ' '; ++p)
+		;
+	for (val=0; p < end_p && *p >= '0' && *p <= '9'; ++p)
+		val = val * 10 + (unsigned long)(*p - '0');
+
+	// values are in kB, we display (roughly) MB
+	*(unsigned long*)((char*)info_p + key_p->offset) = val / 1000;
+	*found_p |= 1u << idx;
+	VERBOSE ("%s:%lu\n", key_p->key_p, val);
+
+next:
+	p = memchr (p, '\n', (size_t)(end_p - p));
+	return p ? p + 1 : end_p;
+}
+
+/*
+ * Takes a snapshot of the whole file with a single pread() into
+ * meminfoBuf_pG, returns its length (-1 on error).
+ */
+static ssize_t
+meminfo_snapshot (int fd)
+{
+	ssize_t len;
+	char *newBuf_p;
+
+	while (1) {
+		len = pread (fd, meminfoBuf_pG, meminfoBufSz_G, 0);
+		if (len < 0) {
+			perror ("pread()");
+			return -1;
+		}
+		if ((size_t)len < meminfoBufSz_G)
+			return len;
+
+		// the snapshot didn't fit, grow the buffer and try again
+		newBuf_p = (char*)realloc (meminfoBuf_pG, meminfoBufSz_G * 2);
+		if (newBuf_p == NULL) {
+			perror ("realloc()");
+			return -1;
+		}
+		meminfoBuf_pG = newBuf_p;
+		meminfoBufSz_G *= 2;
+	}
+}
+
+/*
+ * Decodes all the keys of interest from a snapshot in one pass, stopping
+ * as soon as they've all been seen. Returns the mask of those found.
+ */
+static unsigned
+meminfo_decode (const char *p, const char *end_p, AsmemMeminfo_t *info_p)
+{
+	unsigned found = 0;
+
+	memset (info_p, 0, sizeof (*info_p));
+	while (p < end_p && found != (1u << MEMINFO_NKEYS) - 1)
+		p = meminfo_parse_line (meminfoKeys_G, meminfoIndex_G, p, end_p, info_p, &found);
+	return found;
+}
+
+static bool
+read_meminfo (void)
+{
+	ssize_t len;
+	unsigned found;
+	AsmemMeminfo_t info;
+
+	// a publisher stuck in the middle of a sample is given up on
+	if (shm_subscribed ()) {
+		if (shm_read (&mon_pG->fresh))
+			return true;
+		shm_lost ("is stuck");
+	}
+
+	if (mon_pG->meminfoFd == -1 && (mon_pG->meminfoFd = open (mon_pG->filename, O_RDONLY | O_CLOEXEC)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	if ((len = meminfo_snapshot (mon_pG->meminfoFd)) < 0)
+		return false;
+
+	found = meminfo_decode (meminfoBuf_pG, meminfoBuf_pG + len, &info);
+	if (found != (1u << MEMINFO_NKEYS) - 1)
+		VERBOSE ("%s is missing some fields (found mask 0x%x)\n", mon_pG->filename, found);
+
+	memcpy (&mon_pG->fresh, &info, sizeof (mon_pG->fresh));
+	return true;
+}
+
+static bool
+open_meminfo (void)
+{
+	if (shmFilename_G[0] != 0 && !shmPublish_G) {
+		if (shm_pG == NULL && !shm_subscriber_open ())
+			return false;
+	}
+	else if ((mon_pG->meminfoFd = open (mon_pG->filename, O_RDONLY | O_CLOEXEC)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	// the snapshot buffer is shared by all the monitors
+	if (meminfoBuf_pG != NULL)
+		return true;
+	if ((meminfoBuf_pG = (char*)malloc (MEMINFO_BUFSZ)) == NULL) {
+		perror ("malloc()");
+		return false;
+	}
+	meminfoBufSz_G = MEMINFO_BUFSZ;
+	meminfo_build_index (meminfoKeys_G, MEMINFO_NKEYS, meminfoIndex_G);
+	return true;
+}
+
+static void
+close_meminfo (void)
+{
+	unsigned i;
+
+	for (i=0; i<monitorCnt_G; ++i)
+		if (monitors_G[i].meminfoFd != -1) {
+			close (monitors_G[i].meminfoFd);
+			monitors_G[i].meminfoFd = -1;
+		}
+	free (meminfoBuf_pG);
+	meminfoBuf_pG = NULL;
+	meminfoBufSz_G = 0;
+}
+
+/* the largest change of any field between two samples */
+static unsigned long
+meminfo_delta (const AsmemMeminfo_t *a_p, const AsmemMeminfo_t *b_p)
+{
+	unsigned i;
+	unsigned long a, b, delta = 0;
+
+	for (i=0; i<MEMINFO_NKEYS; ++i) {
+		a = *(const unsigned long*)((const char*)a_p + meminfoKeys_G[i].offset);
+		b = *(const unsigned long*)((const char*)b_p + meminfoKeys_G[i].offset);
+		if ((a > b ? a - b : b - a) > delta)
+			delta = a > b ? a - b : b - a;
+	}
+	return delta;
+}
+
+/* the kernel's estimate of what can be had without swapping, or ours */
+static unsigned long
+meminfo_available (const AsmemMeminfo_t *info_p)
+{
+	unsigned long avail;
+
+	// there's no MemAvailable before 3.14, nor in cgroups, NUMA nodes and from old agents
+	if (info_p->memAvailable != 0)
+		avail = info_p->memAvailable;
+	else
+		avail = info_p->memFree + info_p->memBuffers + info_p->memCached;
+	return avail < info_p->memTotal ? avail : info_p->memTotal;
+}
+
+/* used memory, as --used counts it */
+static unsigned long
+meminfo_used (const AsmemMeminfo_t *info_p)
+{
+	if (usedAvail_G)
+		return info_p->memTotal - meminfo_available (info_p);
+	return info_p->memFree < info_p->memTotal ? info_p->memTotal - info_p->memFree : 0;
+}
+
+/*
+ * The three segments of the memory bar, cut short where they would add
+ * up to more than MemTotal: used by applications, buffers and cache, or
+ * the --bars fields.
+ */
+static void
+meminfo_segments (const AsmemMeminfo_t *info_p, unsigned long *seg_p)
+{
+	unsigned long used, rest = info_p->memTotal;
+	unsigned i;
+
+	if (barFieldCnt_G == 0) {
+		used = meminfo_used (info_p);
+		seg_p[1] = info_p->memBuffers;
+		seg_p[2] = info_p->memCached;
+		// what isn't available leaves out (most of) the buffers and cache already
+		if (usedAvail_G)
+			seg_p[0] = used;
+		else
+			seg_p[0] = used > seg_p[1] + seg_p[2] ? used - seg_p[1] - seg_p[2] : 0;
+	}
+	else
+		for (i=0; i<3; ++i)
+			seg_p[i] = i < barFieldCnt_G ? *(const unsigned long*)((const char*)info_p + barFields_G[i]) : 0;
+
+	for (i=0; i<3; ++i) {
+		if (seg_p[i] > rest)
+			seg_p[i] = rest;
+		rest -= seg_p[i];
+	}
+}
+
+/* parses --bars, a comma separated list of meminfo keys */
+static bool
+meminfo_set_bars (const char *list_p)
+{
+	const char *end_p;
+	size_t len;
+	unsigned i;
+
+	barFieldCnt_G = 0;
+	for (; *list_p; list_p=(*end_p ? end_p + 1 : end_p)) {
+		if ((end_p = strchr (list_p, ',')) == NULL)
+			end_p = list_p + strlen (list_p);
+		len = (size_t)(end_p - list_p);
+		for (i=0; i<MEMINFO_NKEYS; ++i)
+			if (meminfoKeys_G[i].len == len && memcmp (meminfoKeys_G[i].key_p, list_p, len) == 0)
+				break;
+		if (i == MEMINFO_NKEYS || barFieldCnt_G == 3) {
+			printf ("asmem: --bars takes up to 3 of");
+			for (i=0; i<MEMINFO_NKEYS; ++i)
+				printf (" %s", meminfoKeys_G[i].key_p);
+			printf ("\n");
+			return false;
+		}
+		barFields_G[barFieldCnt_G++] = meminfoKeys_G[i].offset;
+	}
+	return true;
+}
+
+/*
+ * Takes a new sample for every monitor and redraws those in which
+ * anything changed. Returns the largest change of any field since the
+ * last sample.
+ */
+static unsigned long
+meminfo_update (void)
+{
+	unsigned long delta, maxDelta = 0;
+
+	for (mon_pG=monitors_G; mon_pG<monitors_G+monitorCnt_G; ++mon_pG)
+		if ((delta = meminfo_update_monitor ()) > maxDelta)
+			maxDelta = delta;
+	mon_pG = &monitors_G[0];
+	if (metricsListenFd_G != -1)
+		metrics_render ();
+	return maxDelta;
+}
+
+/* the same for the current monitor */
+static unsigned long
+meminfo_update_monitor (void)
+{
+	unsigned long delta;
+	uint64_t start = sched_now ();
+
+	if (!read_meminfo ()) {
+		cleanup ();
+		exit (1);
+	}
+	stats_record (&statsRead_G, sched_now () - start);
+	++statsSamples_G;
+	if (cgroupPath_G[0] != 0 || cgroupTopPath_G[0] != 0)
+		cgroup_read (&mon_pG->fresh);
+	if (swaps_G)
+		swaps_read (&mon_pG->fresh);
+	if (top_G) {
+		start = sched_now ();
+		top_scan ();
+		stats_record (&statsTop_G, sched_now () - start);
+	}
+	if (alertCnt_G)
+		alert_check ();
+	if (recRunning_G)
+		rec_push (&mon_pG->fresh);
+	if (trend_G)
+		trend_update (&mon_pG->trends, &mon_pG->fresh, sched_now ());
+
+	if (!mon_pG->sampled) {
+		mon_pG->sampled = true;
+		delta = ULONG_MAX;
+	}
+	else
+		delta = meminfo_delta (&mon_pG->last, &mon_pG->fresh);
+
+	// the graph moves on with every sample, changed or not
+	if (history_G)
+		history_push (&mon_pG->fresh);
+	if (numa_G)
+		numa_read ();
+
+	if (headless_G) {
+		memcpy (&mon_pG->last, &mon_pG->fresh, sizeof (AsmemMeminfo_t));
+		if (netListenFd_G != -1)
+			net_publish (&mon_pG->fresh);
+		if (shmPublish_G && shm_pG != NULL)
+			shm_publish (&mon_pG->fresh);
+		if (outputFd_G != -1)
+			output_sample (netNodeCnt_G ? netHostname_G : NULL, 0, &mon_pG->fresh, &mon_pG->trends);
+	}
+	else if (!mon_pG->visible)
+		++statsSkipped_G;
+#ifdef USE_SHM
+	else if (mon_pG->fbInFlight) {
+		// the server is still reading the frame, fb_completed() draws this one in full
+		mon_pG->fbDeferred = true;
+		mon_pG->drawnValid = false;
+		++statsSkipped_G;
+	}
+#endif
+	else if (delta || history_G || numa_G || top_G || trend_G || swaps_G || mon_pG->alertOn || mon_pG->alertLit)
+		x11_redraw ();
+	else
+		++statsSkipped_G;
+	return delta;
+}
+
+static bool
+history_initialize (unsigned len)
+{
+	mon_pG->history_p = (AsmemMeminfo_t*)calloc (len, sizeof (AsmemMeminfo_t));
+	if (mon_pG->history_p == NULL) {
+		perror ("calloc()");
+		return false;
+	}
+	historyLen_G = len;
+	mon_pG->historyHead = mon_pG->historyCnt = 0;
+	return true;
+}
+
+static void
+history_push (const AsmemMeminfo_t *info_p)
+{
+	memcpy (&mon_pG->history_p[mon_pG->historyHead], info_p, sizeof (AsmemMeminfo_t));
+	mon_pG->historyHead = (mon_pG->historyHead + 1) % historyLen_G;
+	if (mon_pG->historyCnt < historyLen_G)
+		++mon_pG->historyCnt;
+}
+
+/* the sample taken age samples ago (0 is the latest), NULL if there's none */
+static const AsmemMeminfo_t*
+history_get (unsigned age)
+{
+	if (age >= mon_pG->historyCnt)
+		return NULL;
+	return &mon_pG->history_p[(mon_pG->historyHead + historyLen_G - 1 - age) % historyLen_G];
+}
+
+/* cgroup paths can be given relative to the cgroup2 mount */
+static void
+cgroup_set_path (char *dest_p, const char *path_p)
+{
+	if (path_p[0] == '/')
+		safe_copy (dest_p, path_p, FNAMESZ);
+	else
+		snprintf (dest_p, FNAMESZ, "%s/%s", CGROUP_ROOT, path_p);
+}
+
+static bool
+cgroup_open (const char *path_p)
+{
+	static const char *files[cgCOUNT] = {
+		"memory.current", "memory.max", "memory.stat",
+		"memory.swap.current", "memory.swap.max", "memory.events",
+	};
+	char name[FNAMESZ];
+	unsigned i;
+
+	cgroup_close ();
+	for (i=0; i<cgCOUNT; ++i) {
+		snprintf (name, sizeof (name), "%s/%s", path_p, files[i]);
+		cgroupFd_G[i] = open (name, O_RDONLY | O_CLOEXEC);
+		// no swap accounting is fine, the rest isn't
+		if (cgroupFd_G[i] == -1 && i != cgSWAPCURRENT && i != cgSWAPMAX) {
+			printf ("asmem: can't open %s: %s\n", name, strerror (errno));
+			cgroup_close ();
+			return false;
+		}
+	}
+	safe_copy (cgroupPath_G, path_p, sizeof (cgroupPath_G));
+	VERBOSE ("following %s\n", cgroupPath_G);
+
+	cgroupEvents_G = 0;
+	cgroup_check_events ();
+	return true;
+}
+
+static void
+cgroup_close (void)
+{
+	unsigned i;
+
+	for (i=0; i<cgCOUNT; ++i) {
+		if (cgroupFd_G[i] != -1)
+			close (cgroupFd_G[i]);
+		cgroupFd_G[i] = -1;
+	}
+}
+
+/* reads a single number file, "max" is ULONG_MAX */
+static bool
+cgroup_read_value (int fd, unsigned long *val_p)
+{
+	char buf[32];
+	ssize_t len;
+	const char *p;
+
+	if (fd == -1 || (len = pread (fd, buf, sizeof (buf), 0)) <= 0)
+		return false;
+	if (len >= 3 && memcmp (buf, "max", 3) == 0) {
+		*val_p = ULONG_MAX;
+		return true;
+	}
+	for (p=buf, *val_p=0; p < buf + len && *p >= '0' && *p <= '9'; ++p)
+		*val_p = *val_p * 10 + (unsigned long)(*p - '0');
+	return true;
+}
+
+/*
+ * Replaces the system-wide numbers in info_p with the cgroup's: its
+ * limit (or the machine, if there is none) is the total, its usage the
+ * used part and the page cache charged to it ("file") the cache.
+ */
+static void
+cgroup_read (AsmemMeminfo_t *info_p)
+{
+	unsigned long current, max, file = 0, swapCurrent = 0, swapMax = 0;
+	const char *p, *end_p;
+	ssize_t len;
+
+	if (cgroupTopPath_G[0] != 0 && cgroupTicks_G++ % CGROUP_RESCAN == 0)
+		cgroup_scan ();
+	if (!cgroup_read_value (cgroupFd_G[cgCURRENT], &current) || !cgroup_read_value (cgroupFd_G[cgMAX], &max))
+		return;
+
+	if ((len = meminfo_snapshot (cgroupFd_G[cgSTAT])) > 0) {
+		end_p = meminfoBuf_pG + len;
+		for (p=meminfoBuf_pG; p<end_p; ) {
+			if (end_p - p > 5 && memcmp (p, "file ", 5) == 0) {
+				for (p+=5; p < end_p && *p >= '0' && *p <= '9'; ++p)
+					file = file * 10 + (unsigned long)(*p - '0');
+				break;
+			}
+			p = memchr (p, '\n', (size_t)(end_p - p));
+			p = p ? p + 1 : end_p;
+		}
+	}
+
+	// bytes, we display (roughly) MB like the rest
+	current /= 1024 * 1000;
+	file /= 1024 * 1000;
+	if (max != ULONG_MAX && max / (1024 * 1000) < info_p->memTotal)
+		info_p->memTotal = max / (1024 * 1000);
+	if (current > info_p->memTotal)
+		current = info_p->memTotal;
+	info_p->memFree = info_p->memTotal - current;
+	info_p->memBuffers = 0;
+	info_p->memCached = file < current ? file : current;
+	info_p->memAvailable = 0;	// the system's, estimated from the above instead
+
+	if (cgroup_read_value (cgroupFd_G[cgSWAPCURRENT], &swapCurrent) && cgroup_read_value (cgroupFd_G[cgSWAPMAX], &swapMax)) {
+		swapCurrent /= 1024 * 1000;
+		if (swapMax != ULONG_MAX && swapMax / (1024 * 1000) < info_p->swapTotal)
+			info_p->swapTotal = swapMax / (1024 * 1000);
+		if (swapCurrent > info_p->swapTotal)
+			swapCurrent = info_p->swapTotal;
+		info_p->swapFree = info_p->swapTotal - swapCurrent;
+	}
+	else
+		info_p->swapTotal = info_p->swapFree = 0;
+}
+
+/*
+ * Reads memory.events (which also re-arms its POLLPRI notification).
+ * Returns true if there were new high, max or oom events since the last
+ * call.
+ */
+static bool
+cgroup_check_events (void)
+{
+	static const char *keys[] = {"high ", "max ", "oom ", "oom_kill "};
+	const char *p, *end_p;
+	unsigned long total = 0, val;
+	unsigned i;
+	ssize_t len;
+	bool news;
+
+	if ((len = meminfo_snapshot (cgroupFd_G[cgEVENTS])) <= 0)
+		return false;
+	end_p = meminfoBuf_pG + len;
+	for (p=meminfoBuf_pG; p<end_p; ) {
+		for (i=0; i<sizeof (keys) / sizeof (keys[0]); ++i) {
+			len = (ssize_t)strlen (keys[i]);
+			if (end_p - p > len && memcmp (p, keys[i], (size_t)len) == 0) {
+				for (p+=len, val=0; p < end_p && *p >= '0' && *p <= '9'; ++p)
+					val = val * 10 + (unsigned long)(*p - '0');
+				total += val;
+				break;
+			}
+		}
+		p = memchr (p, '\n', (size_t)(end_p - p));
+		p = p ? p + 1 : end_p;
+	}
+
+	// cgroupEvents_G is 0 only before the first read
+	news = cgroupEvents_G && total + 1 > cgroupEvents_G;
+	if (news)
+		VERBOSE ("%lu new events in %s\n", total + 1 - cgroupEvents_G, cgroupPath_G);
+	cgroupEvents_G = total + 1;
+	return news;
+}
+
+/*
+ * Walks the hierarchy below path_p for the cgroup with a memory.max
+ * whose usage is closest to it. path_p is used as scratch space.
+ */
+static void
+cgroup_find_top (char *path_p, size_t len, unsigned depth, double *best_p, char *bestPath_p)
+{
+	DIR *dir_p;
+	struct dirent *entry_p;
+	size_t end = strlen (path_p);
+	unsigned long current, max;
+	int fd;
+
+	if ((size_t)snprintf (path_p + end, len - end, "/memory.max") < len - end && (fd = open (path_p, O_RDONLY | O_CLOEXEC)) != -1) {
+		if (cgroup_read_value (fd, &max) && max != ULONG_MAX && max != 0) {
+			close (fd);
+			snprintf (path_p + end, len - end, "/memory.current");
+			if ((fd = open (path_p, O_RDONLY | O_CLOEXEC)) != -1 && cgroup_read_value (fd, &current) && (double)current / (double)max > *best_p) {
+				*best_p = (double)current / (double)max;
+				path_p[end] = 0;
+				safe_copy (bestPath_p, path_p, FNAMESZ);
+			}
+		}
+		if (fd != -1)
+			close (fd);
+	}
+	path_p[end] = 0;
+
+	if (depth == 0 || (dir_p = opendir (path_p)) == NULL)
+		return;
+	while ((entry_p = readdir (dir_p)) != NULL) {
+		if (entry_p->d_type != DT_DIR || entry_p->d_name[0] == '.')
+			continue;
+		if ((size_t)snprintf (path_p + end, len - end, "/%s", entry_p->d_name) >= len - end)
+			continue;
+		cgroup_find_top (path_p, len, depth - 1, best_p, bestPath_p);
+		path_p[end] = 0;
+	}
+	closedir (dir_p);
+}
+
+/* switches to the busiest cgroup below --cgroup-top's, if that changed */
+static void
+cgroup_scan (void)
+{
+	char path[FNAMESZ], best[FNAMESZ];
+	double ratio = -1.0;
+
+	safe_copy (path, cgroupTopPath_G, sizeof (path));
+	best[0] = 0;
+	cgroup_find_top (path, sizeof (path), CGROUP_MAXDEPTH, &ratio, best);
+	if (best[0] != 0 && (cgroupFd_G[cgCURRENT] == -1 || strcmp (best, cgroupPath_G) != 0))
+		cgroup_open (best);
+}
+
+static int
+numa_compare (const void *a_p, const void *b_p)
+{
+	unsigned a = *(const unsigned*)a_p, b = *(const unsigned*)b_p;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Finds the nodes and opens their meminfo and numastat files, which
+ * numa_read() then pread()s every tick.
+ */
+static bool
+numa_initialize (void)
+{
+	DIR *dir_p;
+	struct dirent *entry_p;
+	unsigned *ids_p = NULL, *more_p, idCnt = 0, idRoom = 0, i;
+	char path[FNAMESZ], *end_p;
+	unsigned long id;
+
+	dir_p = opendir (NUMA_SYSFS);
+	if (dir_p == NULL) {
+		perror ("opendir()");
+		return false;
+	}
+	// all of them, readdir() doesn't list them in order
+	while ((entry_p = readdir (dir_p)) != NULL) {
+		if (strncmp (entry_p->d_name, "node", 4) != 0)
+			continue;
+		id = strtoul (entry_p->d_name + 4, &end_p, 10);
+		if (end_p == entry_p->d_name + 4 || *end_p != 0)
+			continue;
+		if (idCnt == idRoom) {
+			idRoom = idRoom ? idRoom * 2 : NUMA_MAXNODES;
+			if ((more_p = (unsigned*)realloc (ids_p, idRoom * sizeof (ids_p[0]))) == NULL) {
+				perror ("realloc()");
+				free (ids_p);
+				closedir (dir_p);
+				return false;
+			}
+			ids_p = more_p;
+		}
+		ids_p[idCnt++] = (unsigned)id;
+	}
+	closedir (dir_p);
+	if (idCnt == 0) {
+		printf ("asmem: no NUMA nodes in %s\n", NUMA_SYSFS);
+		return false;
+	}
+	qsort (ids_p, idCnt, sizeof (ids_p[0]), numa_compare);
+	numaNodeCnt_G = idCnt < NUMA_MAXNODES ? idCnt : NUMA_MAXNODES;
+	if (idCnt > numaNodeCnt_G)
+		printf ("asmem: %u NUMA nodes, only node%u to node%u are shown\n", idCnt, ids_p[0], ids_p[numaNodeCnt_G - 1]);
+	for (i=0; i<numaNodeCnt_G; ++i) {
+		numaNodes_G[i].id = ids_p[i];
+		numaNodes_G[i].meminfoFd = numaNodes_G[i].numastatFd = -1;
+	}
+	free (ids_p);
+
+	for (i=0; i<numaNodeCnt_G; ++i) {
+		snprintf (path, sizeof (path), "%s/node%u/meminfo", NUMA_SYSFS, numaNodes_G[i].id);
+		if ((numaNodes_G[i].meminfoFd = open (path, O_RDONLY | O_CLOEXEC)) == -1) {
+			perror ("open()");
+			return false;
+		}
+		snprintf (path, sizeof (path), "%s/node%u/numastat", NUMA_SYSFS, numaNodes_G[i].id);
+		numaNodes_G[i].numastatFd = open (path, O_RDONLY | O_CLOEXEC);
+	}
+	meminfo_build_index (numaKeys_G, NUMA_NKEYS, numaIndex_G);
+	numa_read ();
+	return true;
+}
+
+/*
+ * Samples every node the way read_meminfo() does the whole system, and
+ * works out the remote share of the allocations since the last call.
+ */
+static void
+numa_read (void)
+{
+	AsmemNumaNode_t *node_p;
+	const char *p, *end_p;
+	unsigned long local = 0, other = 0, *val_p;
+	unsigned i, found;
+	ssize_t len;
+
+	for (i=0; i<numaNodeCnt_G; ++i) {
+		node_p = &numaNodes_G[i];
+
+		if ((len = meminfo_snapshot (node_p->meminfoFd)) >= 0) {
+			memset (&node_p->info, 0, sizeof (node_p->info));
+			end_p = meminfoBuf_pG + len;
+			for (p=meminfoBuf_pG, found=0; p<end_p && found != (1u << NUMA_NKEYS) - 1; )
+				p = meminfo_parse_line (numaKeys_G, numaIndex_G, p, end_p, &node_p->info, &found);
+		}
+
+		// "local_node <pages>" and "other_node <pages>" lines
+		if (node_p->numastatFd == -1 || (len = meminfo_snapshot (node_p->numastatFd)) < 0)
+			continue;
+		end_p = meminfoBuf_pG + len;
+		for (p=meminfoBuf_pG; p<end_p; ) {
+			val_p = NULL;
+			if (end_p - p > 11 && memcmp (p, "local_node ", 11) == 0)
+				val_p = &local;
+			else if (end_p - p > 11 && memcmp (p, "other_node ", 11) == 0)
+				val_p = &other;
+			if (val_p) {
+				unsigned long val, *prev_p = val_p == &local ? &node_p->localNode : &node_p->otherNode;
+
+				for (p+=11, val=0; p < end_p && *p >= '0' && *p <= '9'; ++p)
+					val = val * 10 + (unsigned long)(*p - '0');
+				if (*prev_p && val >= *prev_p)
+					*val_p += val - *prev_p;
+				*prev_p = val;
+			}
+			p = memchr (p, '\n', (size_t)(end_p - p));
+			p = p ? p + 1 : end_p;
+		}
+	}
+
+	// an idle tick keeps the last value
+	if (local + other)
+		numaRemotePct_G = (unsigned)((double)other / (double)(local + other) * 100.0);
+	VERBOSE ("%u nodes, %u%% remote\n", numaNodeCnt_G, numaRemotePct_G);
+}
+
+static void
+numa_cleanup (void)
+{
+	unsigned i;
+
+	for (i=0; i<numaNodeCnt_G; ++i) {
+		if (numaNodes_G[i].meminfoFd != -1)
+			close (numaNodes_G[i].meminfoFd);
+		if (numaNodes_G[i].numastatFd != -1)
+			close (numaNodes_G[i].numastatFd);
+	}
+	numaNodeCnt_G = 0;
+}
+
+/* the next blank-separated word of a line, NULL at its end */
+static const char*
+swaps_word (const char **p_p, const char *end_p, size_t *len_p)
+{
+	const char *p = *p_p, *word_p;
+
+	while (p < end_p && (*p == ' ' || *p == '\t'))
+		++p;
+	for (word_p=p; p < end_p && *p != ' ' && *p != '\t' && *p != '\n'; ++p)
+		;
+	*p_p = p;
+	*len_p = (size_t)(p - word_p);
+	return *len_p ? word_p : NULL;
+}
+
+/* the same, as a number (0 if it isn't one) */
+static unsigned long
+swaps_number (const char **p_p, const char *end_p)
+{
+	const char *word_p;
+	unsigned long val = 0;
+	size_t len;
+
+	if ((word_p = swaps_word (p_p, end_p, &len)) == NULL)
+		return 0;
+	for (; len && *word_p >= '0' && *word_p <= '9'; ++word_p, --len)
+		val = val * 10 + (unsigned long)(*word_p - '0');
+	return val;
+}
+
+/*
+ * Opens /proc/swaps and, where the kernel has them and we may read them,
+ * zswap's debugfs counters. The zram devices' files are opened as they
+ * turn up in /proc/swaps.
+ */
+static bool
+swaps_open (void)
+{
+	if ((swapsFd_G = open (SWAPS_PROC, O_RDONLY | O_CLOEXEC)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	swapsZswapFd_G[0] = open (SWAPS_ZSWAP "/stored_pages", O_RDONLY | O_CLOEXEC);
+	swapsZswapFd_G[1] = open (SWAPS_ZSWAP "/pool_total_size", O_RDONLY | O_CLOEXEC);
+	swapsPageSz_G = sysconf (_SC_PAGESIZE);
+	return true;
+}
+
+/* a device which just turned up in /proc/swaps, NULL if there are too many */
+static AsmemSwapDev_t*
+swaps_add_dev (const char *path_p, size_t len)
+{
+	AsmemSwapDev_t *dev_p;
+	char path[FNAMESZ];
+
+	if (swapDevCnt_G == SWAPS_MAXDEVS || len >= sizeof (dev_p->path))
+		return NULL;
+	dev_p = &swapDevs_G[swapDevCnt_G++];
+	memset (dev_p, 0, sizeof (*dev_p));
+	memcpy (dev_p->path, path_p, len);
+	dev_p->mmStatFd = -1;
+	// /dev/zram<n> keeps its statistics in /sys/block/zram<n>/mm_stat
+	if (len > 9 && memcmp (path_p, "/dev/zram", 9) == 0) {
+		snprintf (path, sizeof (path), "/sys/block/%s/mm_stat", dev_p->path + 5);
+		dev_p->mmStatFd = open (path, O_RDONLY | O_CLOEXEC);
+	}
+	VERBOSE ("swap device %s%s\n", dev_p->path, dev_p->mmStatFd != -1 ? ", zram" : "");
+	return dev_p;
+}
+
+/*
+ * Reads /proc/swaps and the counters of zram and zswap, and works out
+ * how much of the used swap is on disk and how much is compressed RAM.
+ * zswap's pages hold on to their slots on the disk they'd go to, so
+ * they're taken off its share.
+ */
+static void
+swaps_read (const AsmemMeminfo_t *info_p)
+{
+	AsmemSwapDev_t *dev_p;
+	const char *p, *end_p, *word_p;
+	unsigned long zswapped = info_p->zswapped, zswap = info_p->zswap, disk = 0;
+	unsigned i;
+	size_t len;
+	ssize_t rtn;
+
+	for (i=0; i<swapDevCnt_G; ++i)
+		swapDevs_G[i].seen = false;
+	if ((rtn = meminfo_snapshot (swapsFd_G)) < 0)
+		return;
+
+	// "Filename Type Size Used Priority", sizes in kB, after a header line
+	end_p = meminfoBuf_pG + rtn;
+	p = memchr (meminfoBuf_pG, '\n', (size_t)rtn);
+	for (p=(p ? p + 1 : end_p); p<end_p; ) {
+		if ((word_p = swaps_word (&p, end_p, &len)) != NULL) {
+			for (i=0; i<swapDevCnt_G; ++i)
+				if (strlen (swapDevs_G[i].path) == len && memcmp (swapDevs_G[i].path, word_p, len) == 0)
+					break;
+			dev_p = i < swapDevCnt_G ? &swapDevs_G[i] : swaps_add_dev (word_p, len);
+			if (dev_p) {
+				if ((word_p = swaps_word (&p, end_p, &len)) != NULL && len < sizeof (dev_p->type)) {
+					memcpy (dev_p->type, word_p, len);
+					dev_p->type[len] = 0;
+				}
+				dev_p->size = swaps_number (&p, end_p) / 1000;
+				dev_p->used = swaps_number (&p, end_p) / 1000;
+				dev_p->seen = true;
+			}
+		}
+		p = memchr (p, '\n', (size_t)(end_p - p));
+		p = p ? p + 1 : end_p;
+	}
+
+	// swapoff: the device goes, the others move up
+	for (i=0; i<swapDevCnt_G; ) {
+		if (swapDevs_G[i].seen) {
+			++i;
+			continue;
+		}
+		if (swapDevs_G[i].mmStatFd != -1)
+			close (swapDevs_G[i].mmStatFd);
+		memmove (&swapDevs_G[i], &swapDevs_G[i + 1], (swapDevCnt_G - i - 1) * sizeof (swapDevs_G[0]));
+		--swapDevCnt_G;
+	}
+
+	swapsFast_G = swapsOrig_G = swapsCompr_G = 0;
+	for (i=0; i<swapDevCnt_G; ++i) {
+		dev_p = &swapDevs_G[i];
+		if (dev_p->mmStatFd == -1) {
+			disk += dev_p->used;
+			continue;
+		}
+		// "orig_data_size compr_data_size mem_used_total ...", in bytes
+		if ((rtn = meminfo_snapshot (dev_p->mmStatFd)) >= 0) {
+			p = meminfoBuf_pG;
+			end_p = meminfoBuf_pG + rtn;
+			dev_p->orig = swaps_number (&p, end_p) / 1024000;
+			swaps_number (&p, end_p);
+			dev_p->compr = swaps_number (&p, end_p) / 1024000;
+		}
+		swapsFast_G += dev_p->used;
+		swapsOrig_G += dev_p->orig;
+		swapsCompr_G += dev_p->compr;
+	}
+
+	// kernels before 5.19 only tell root, through debugfs
+	if (zswapped == 0 && swapsZswapFd_G[0] != -1 && swapsZswapFd_G[1] != -1) {
+		if ((rtn = meminfo_snapshot (swapsZswapFd_G[0])) >= 0) {
+			p = meminfoBuf_pG;
+			zswapped = swaps_number (&p, meminfoBuf_pG + rtn) * (unsigned long)swapsPageSz_G / 1024000;
+		}
+		if ((rtn = meminfo_snapshot (swapsZswapFd_G[1])) >= 0) {
+			p = meminfoBuf_pG;
+			zswap = swaps_number (&p, meminfoBuf_pG + rtn) / 1024000;
+		}
+	}
+	if (zswapped > disk)
+		zswapped = disk;
+	swapsSlow_G = disk - zswapped;
+	swapsFast_G += zswapped;
+	swapsOrig_G += zswapped;
+	swapsCompr_G += zswap;
+	VERBOSE ("%u swap devices, %lu on disk, %lu compressed into %lu\n", swapDevCnt_G, swapsSlow_G, swapsOrig_G, swapsCompr_G);
+}
+
+static void
+swaps_cleanup (void)
+{
+	unsigned i;
+
+	for (i=0; i<swapDevCnt_G; ++i)
+		if (swapDevs_G[i].mmStatFd != -1)
+			close (swapDevs_G[i].mmStatFd);
+	swapDevCnt_G = 0;
+	for (i=0; i<2; ++i) {
+		if (swapsZswapFd_G[i] != -1)
+			close (swapsZswapFd_G[i]);
+		swapsZswapFd_G[i] = -1;
+	}
+	if (swapsFd_G != -1)
+		close (swapsFd_G);
+	swapsFd_G = -1;
+}
+
+/* ------------------------------------------------------------------------- */
+// headless output
+/* ------------------------------------------------------------------------- */
+/* lets the main loop exit (and flush) on SIGINT/SIGTERM */
+static void
+output_quit (int sig)
+{
+	(void)sig;
+	quit_G = 1;
+}
+
+static bool
+output_open (void)
+{
+	static const char *trendColumn_p[] = {"_ewma", "_min", "_max", "_rate"};
+	char *p = outputBuf_G;
+	unsigned i, j;
+
+	if (outputFilename_G[0] == 0)
+		outputFd_G = STDOUT_FILENO;
+	else if ((outputFd_G = open (outputFilename_G, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1) {
+		perror ("open()");
+		return false;
+	}
+
+	// a CSV header, unless we're appending to an existing file
+	if (outputFormat_G == fmtCSV && (outputFd_G == STDOUT_FILENO || lseek (outputFd_G, 0, SEEK_END) == 0)) {
+		if (netNodeCnt_G)
+			p = stpcpy (p, "node,");
+		p = stpcpy (p, "time");
+		for (i=0; i<MEMINFO_NKEYS; ++i) {
+			*p++ = ',';
+			p = stpcpy (p, meminfoKeys_G[i].key_p);
+		}
+		for (i=0; i<MEMINFO_NKEYS && trend_G; ++i)
+			for (j=0; j<sizeof (trendColumn_p) / sizeof (trendColumn_p[0]); ++j) {
+				*p++ = ',';
+				p = stpcpy (stpcpy (p, meminfoKeys_G[i].key_p), trendColumn_p[j]);
+			}
+		if (trend_G)
+			p = stpcpy (p, ",Growth,OomEta");
+		*p++ = '\n';
+		outputLen_G = (size_t)(p - outputBuf_G);
+		output_flush ();
+	}
+	return true;
+}
+
+static void
+output_close (void)
+{
+	if (outputFd_G == -1)
+		return;
+	output_flush ();
+	if (outputFd_G != STDOUT_FILENO)
+		close (outputFd_G);
+	outputFd_G = -1;
+}
+
+static void
+output_flush (void)
+{
+	size_t done = 0;
+	ssize_t rtn;
+
+	while (done < outputLen_G) {
+		rtn = write (outputFd_G, outputBuf_G + done, outputLen_G - done);
+		if (rtn == -1) {
+			if (errno == EINTR)
+				continue;
+			perror ("write()");
+			outputLen_G = 0;
+			outputFd_G = -1;
+			exit (1);
+		}
+		done += (size_t)rtn;
+	}
+	outputLen_G = 0;
+	outputPending_G = 0;
+}
+
+/* formats val in decimal at p, returns the end */
+static char*
+output_ulong (char *p, unsigned long val)
+{
+	char tmp[24];
+	unsigned len = 0;
+
+	do {
+		tmp[len++] = (char)('0' + val % 10);
+		val /= 10;
+	} while (val);
+	while (len)
+		*p++ = tmp[--len];
+	return p;
+}
+
+/* formats a growth rate [per s] with 3 decimals at p, returns the end */
+static char*
+output_rate (char *p, double rate)
+{
+	unsigned long val = (unsigned long)((rate < 0 ? -rate : rate) * 1000 + 0.5);
+
+	if (rate < 0 && val != 0)
+		*p++ = '-';
+	p = output_ulong (p, val / 1000);
+	*p++ = '.';
+	*p++ = (char)('0' + val / 100 % 10);
+	*p++ = (char)('0' + val / 10 % 10);
+	*p++ = (char)('0' + val % 10);
+	return p;
+}
+
+/*
+ * Appends one sample to the output buffer, as a CSV row, a JSON object
+ * on its own line, or a fixed-layout AsmemRecord_t in host byte order.
+ * Samples from --view nodes carry the node's name and the time they were
+ * taken at [ns], local ones are stamped here (time == 0). With --trend,
+ * CSV and JSON carry trends_p's statistics as well (empty or left out
+ * for the nodes, which have none).
+ */
+static void
+output_sample (const char *node_p, uint64_t time, const AsmemMeminfo_t *info_p, const AsmemTrends_t *trends_p)
+{
+	static const char *trendKey_p[] = {"_ewma\":", "_min\":", "_max\":", "_rate\":"};
+	struct timespec now;
+	AsmemRecord_t record;
+	char *p = outputBuf_G + outputLen_G;
+	unsigned long val, min, max;
+	unsigned i, j;
+
+	if (time == 0) {
+		clock_gettime (CLOCK_REALTIME, &now);
+		time = (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+	}
+
+	if (outputFormat_G == fmtBINARY) {
+		record.time = time;
+		for (i=0; i<MEMINFO_BASE; ++i)
+			record.field[i] = *(const unsigned long*)((const char*)info_p + meminfoKeys_G[i].offset);
+		memcpy (p, &record, sizeof (record));
+		p += sizeof (record);
+	}
+	else {
+		if (outputFormat_G == fmtJSON)
+			*p++ = '{';
+		if (node_p) {
+			p = stpcpy (p, outputFormat_G == fmtJSON ? "\"node\":\"" : "");
+			p = stpcpy (p, node_p);
+			p = stpcpy (p, outputFormat_G == fmtJSON ? "\"," : ",");
+		}
+		if (outputFormat_G == fmtJSON)
+			p = stpcpy (p, "\"time\":");
+		p = output_ulong (p, (unsigned long)(time / NSEC_PER_SEC));
+		*p++ = '.';
+		val = (unsigned long)(time % NSEC_PER_SEC / NSEC_PER_MSEC);
+		*p++ = (char)('0' + val / 100);
+		*p++ = (char)('0' + val / 10 % 10);
+		*p++ = (char)('0' + val % 10);
+		for (i=0; i<MEMINFO_NKEYS; ++i) {
+			*p++ = ',';
+			if (outputFormat_G == fmtJSON) {
+				*p++ = '"';
+				p = stpcpy (p, meminfoKeys_G[i].key_p);
+				*p++ = '"';
+				*p++ = ':';
+			}
+			p = output_ulong (p, *(const unsigned long*)((const char*)info_p + meminfoKeys_G[i].offset));
+		}
+		if (trend_G && trends_p == NULL && outputFormat_G == fmtCSV)
+			for (i=0; i<MEMINFO_NKEYS * 4 + 2; ++i)
+				*p++ = ',';
+		for (i=0; i<MEMINFO_NKEYS && trend_G && trends_p; ++i) {
+			trend_range (trends_p, i, &min, &max);
+			for (j=0; j<4; ++j) {
+				*p++ = ',';
+				if (outputFormat_G == fmtJSON) {
+					*p++ = '"';
+					p = stpcpy (stpcpy (p, meminfoKeys_G[i].key_p), trendKey_p[j]);
+				}
+				if (j == 0)
+					p = output_ulong (p, (unsigned long)(trends_p->series[i].ewma + 0.5));
+				else if (j == 3)
+					p = output_rate (p, trends_p->series[i].rate);
+				else
+					p = output_ulong (p, j == 1 ? min : max);
+			}
+		}
+		if (trend_G && trends_p) {
+			p = stpcpy (p, outputFormat_G == fmtJSON ? ",\"Growth\":" : ",");
+			p = output_rate (p, trends_p->series[trALL].rate);
+			p = stpcpy (p, outputFormat_G == fmtJSON ? ",\"OomEta\":" : ",");
+			if (trends_p->eta >= 0)
+				p = output_ulong (p, (unsigned long)trends_p->eta);
+			else if (outputFormat_G == fmtJSON)
+				p = stpcpy (p, "null");
+		}
+		if (outputFormat_G == fmtJSON)
+			*p++ = '}';
+		*p++ = '\n';
+	}
+
+	outputLen_G = (size_t)(p - outputBuf_G);
+	if (++outputPending_G >= outputBatch_G || outputLen_G > OUTPUT_BUFSZ - OUTPUT_RECSZ)
+		output_flush ();
+}
+
+/* ------------------------------------------------------------------------- */
+// top processes
+/* ------------------------------------------------------------------------- */
+/*
+ * Opens /proc once, raises the fd limit so that statm files can stay
+ * open between scans, and starts the worker threads.
+ */
+static bool
+top_initialize (void)
+{
+	struct rlimit limit;
+	sigset_t all, old;
+	long cpus;
+	unsigned i;
+
+	if ((topProcFd_G = open ("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	if ((topDir_pG = fdopendir (dup (topProcFd_G))) == NULL) {
+		perror ("fdopendir()");
+		return false;
+	}
+	topProcs_pG = (AsmemProc_t*)calloc (TOP_MAXPROCS, sizeof (AsmemProc_t));
+	topSpare_pG = (AsmemProc_t*)calloc (TOP_MAXPROCS, sizeof (AsmemProc_t));
+	if (topProcs_pG == NULL || topSpare_pG == NULL) {
+		perror ("calloc()");
+		return false;
+	}
+	topPageKb_G = sysconf (_SC_PAGESIZE) / 1024;
+
+	// what doesn't fit is opened and closed on every scan instead
+	if (getrlimit (RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit (RLIMIT_NOFILE, &limit);
+	}
+
+	// signals are for the main thread
+	cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	sigfillset (&all);
+	pthread_sigmask (SIG_SETMASK, &all, &old);
+	for (i=0; i+1<TOP_WORKERS && (long)i+1<cpus; ++i) {
+		if (pthread_create (&topThreads_G[i], NULL, top_worker, (void*)(uintptr_t)(i + 1)) != 0)
+			break;
+		++topThreadCnt_G;
+	}
+	pthread_sigmask (SIG_SETMASK, &old, NULL);
+	return true;
+}
+
+/* waits for a round of top_scan(), reads its share of the processes */
+static void*
+top_worker (void *arg_p)
+{
+	unsigned part = (unsigned)(uintptr_t)arg_p;
+	unsigned round = 0;
+
+	while (1) {
+		pthread_mutex_lock (&topLock_G);
+		while (topRound_G == round && !topQuit_G)
+			pthread_cond_wait (&topStart_G, &topLock_G);
+		round = topRound_G;
+		if (topQuit_G) {
+			pthread_mutex_unlock (&topLock_G);
+			return NULL;
+		}
+		pthread_mutex_unlock (&topLock_G);
+
+		top_read_range (part);
+
+		pthread_mutex_lock (&topLock_G);
+		if (--topBusy_G == 0)
+			pthread_cond_signal (&topDone_G);
+		pthread_mutex_unlock (&topLock_G);
+	}
+}
+
+/* a process' statm, -1 if it's gone */
+static int
+top_open (int pid)
+{
+	char name[24];
+
+	snprintf (name, sizeof (name), "%d/statm", pid);
+	return openat (topProcFd_G, name, O_RDONLY | O_CLOEXEC);
+}
+
+/* the resident set of one of topThreadCnt_G+1 equal slices of the processes */
+static void
+top_read_range (unsigned part)
+{
+	AsmemProc_t *proc_p, *end_p;
+	char buf[128];
+	const char *p;
+	ssize_t len;
+	int fd;
+
+	proc_p = topProcs_pG + (size_t)topProcCnt_G * part / (topThreadCnt_G + 1);
+	end_p = topProcs_pG + (size_t)topProcCnt_G * (part + 1) / (topThreadCnt_G + 1);
+	for (; proc_p<end_p; ++proc_p) {
+		proc_p->rss = 0;
+		fd = proc_p->fd;
+		if (fd == -1 && (fd = top_open (proc_p->pid)) == -1)
+			continue;
+		len = pread (fd, buf, sizeof (buf) - 1, 0);
+		// a kept fd outlives its process, whose PID may be somebody else's by now
+		if (len <= 0 && fd == proc_p->fd) {
+			close (fd);
+			if ((fd = proc_p->fd = top_open (proc_p->pid)) == -1)
+				continue;
+			len = pread (fd, buf, sizeof (buf) - 1, 0);
+		}
+		if (fd != proc_p->fd)
+			close (fd);
+		if (len <= 0)
+			continue;
+
+		// "size resident shared ...", in pages
+		buf[len] = 0;
+		for (p=buf; *p >= '0' && *p <= '9'; ++p)
+			;
+		for (++p; *p >= '0' && *p <= '9'; ++p)
+			proc_p->rss = proc_p->rss * 10 + (unsigned long)(*p - '0');
+	}
+}
+
+/*
+ * One pass over /proc. The kernel lists PIDs in ascending order, so the
+ * new list is merged with the last one: known PIDs keep their open statm
+ * fd, new ones get opened and the ones which are gone get closed. The
+ * reading is shared with the workers, and a TOP_ROWS sized min-heap
+ * picks the largest.
+ */
+static void
+top_scan (void)
+{
+	struct dirent *entry_p;
+	AsmemProc_t *old_p = topProcs_pG, *new_p = topSpare_pG, heap[TOP_ROWS], tmp;
+	unsigned oldCnt = topProcCnt_G, o = 0, n = 0, opened = 0, closed = 0, heapCnt = 0, i, child;
+	uint64_t start = sched_now ();
+	char *end_p;
+	unsigned long val;
+
+	if (topDir_pG == NULL)
+		return;
+
+	rewinddir (topDir_pG);
+	while ((entry_p = readdir (topDir_pG)) != NULL && n < TOP_MAXPROCS) {
+		if (entry_p->d_name[0] < '0' || entry_p->d_name[0] > '9')
+			continue;
+		val = strtoul (entry_p->d_name, &end_p, 10);
+		if (*end_p != 0)
+			continue;
+
+		while (o < oldCnt && (unsigned long)old_p[o].pid < val) {
+			if (old_p[o].fd != -1)
+				close (old_p[o].fd);
+			++o, ++closed;
+		}
+		if (o < oldCnt && (unsigned long)old_p[o].pid == val) {
+			new_p[n++] = old_p[o++];
+			continue;
+		}
+		new_p[n].pid = (int)val;
+		new_p[n].fd = top_open (new_p[n].pid);
+		++n, ++opened;
+	}
+	for (; o<oldCnt; ++o, ++closed)
+		if (old_p[o].fd != -1)
+			close (old_p[o].fd);
+	topProcs_pG = new_p;
+	topSpare_pG = old_p;
+	topProcCnt_G = n;
+
+	pthread_mutex_lock (&topLock_G);
+	topBusy_G = topThreadCnt_G;
+	++topRound_G;
+	pthread_cond_broadcast (&topStart_G);
+	pthread_mutex_unlock (&topLock_G);
+	top_read_range (0);
+	pthread_mutex_lock (&topLock_G);
+	while (topBusy_G)
+		pthread_cond_wait (&topDone_G, &topLock_G);
+	pthread_mutex_unlock (&topLock_G);
+
+	for (o=0; o<n; ++o) {
+		if (new_p[o].rss == 0)
+			continue;
+		if (heapCnt < TOP_ROWS) {
+			// sift up
+			for (i=heapCnt++; i>0 && heap[(i-1)/2].rss > new_p[o].rss; i=(i-1)/2)
+				heap[i] = heap[(i-1)/2];
+			heap[i] = new_p[o];
+		}
+		else if (new_p[o].rss > heap[0].rss) {
+			// replace the smallest, sift down
+			for (i=0; (child = 2*i+1) < heapCnt; i=child) {
+				if (child + 1 < heapCnt && heap[child+1].rss < heap[child].rss)
+					++child;
+				if (heap[child].rss >= new_p[o].rss)
+					break;
+				heap[i] = heap[child];
+			}
+			heap[i] = new_p[o];
+		}
+	}
+
+	// largest first
+	for (i=1; i<heapCnt; ++i)
+		for (o=i; o>0 && heap[o-1].rss < heap[o].rss; --o) {
+			tmp = heap[o];
+			heap[o] = heap[o-1];
+			heap[o-1] = tmp;
+		}
+	memcpy (topList_G, heap, heapCnt * sizeof (heap[0]));
+	topCnt_G = heapCnt;
+
+	topScanNs_G = sched_now () - start;
+	VERBOSE ("%u processes, %u opened, %u closed, %lu us\n", n, opened, closed, (unsigned long)(topScanNs_G / 1000));
+}
+
+static void
+top_cleanup (void)
+{
+	unsigned i;
+
+	pthread_mutex_lock (&topLock_G);
+	topQuit_G = true;
+	pthread_cond_broadcast (&topStart_G);
+	pthread_mutex_unlock (&topLock_G);
+	for (i=0; i<topThreadCnt_G; ++i)
+		pthread_join (topThreads_G[i], NULL);
+	topThreadCnt_G = 0;
+
+	for (i=0; i<topProcCnt_G; ++i)
+		if (topProcs_pG[i].fd != -1)
+			close (topProcs_pG[i].fd);
+	topProcCnt_G = 0;
+	free (topProcs_pG);
+	free (topSpare_pG);
+	topProcs_pG = topSpare_pG = NULL;
+	if (topDir_pG)
+		closedir (topDir_pG);
+	topDir_pG = NULL;
+	if (topProcFd_G != -1)
+		close (topProcFd_G);
+	topProcFd_G = -1;
+}
+
+/* ------------------------------------------------------------------------- */
+// agent/viewer
+/* ------------------------------------------------------------------------- */
+/*
+ * Turns "unix:<path>", "<host>:<port>", "[<ipv6>]:<port>" or just
+ * "<port>" (any address when listening, the loopback otherwise) into a
+ * socket address.
+ */
+static bool
+net_resolve (const char *addr_p, bool passive, struct sockaddr_storage *sa_p, socklen_t *len_p)
+{
+	struct sockaddr_un *un_p = (struct sockaddr_un*)sa_p;
+	struct addrinfo hints, *res_p;
+	char host[FNAMESZ], *port_p, *host_p = NULL;
+	int rtn;
+
+	memset (sa_p, 0, sizeof (*sa_p));
+	if (strncmp (addr_p, "unix:", 5) == 0) {
+		if (strlen (addr_p + 5) >= sizeof (un_p->sun_path)) {
+			printf ("asmem: socket path too long: %s\n", addr_p + 5);
+			return false;
+		}
+		un_p->sun_family = AF_UNIX;
+		strcpy (un_p->sun_path, addr_p + 5);
+		*len_p = sizeof (*un_p);
+		return true;
+	}
+
+	safe_copy (host, addr_p, sizeof (host));
+	port_p = strrchr (host, ':');
+	if (port_p) {
+		*port_p++ = 0;
+		host_p = host;
+		if (host[0] == '[' && host[strlen (host) - 1] == ']') {
+			host[strlen (host) - 1] = 0;
+			++host_p;
+		}
+		if (*host_p == 0)
+			host_p = NULL;
+	}
+	else
+		port_p = host;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	rtn = getaddrinfo (host_p, port_p, &hints, &res_p);
+	if (rtn != 0) {
+		printf ("asmem: can't resolve %s: %s\n", addr_p, gai_strerror (rtn));
+		return false;
+	}
+	memcpy (sa_p, res_p->ai_addr, res_p->ai_addrlen);
+	*len_p = res_p->ai_addrlen;
+	freeaddrinfo (res_p);
+	return true;
+}
+
+/* returns a non-blocking socket listening on addr_p, or -1 */
+static int
+net_listen (const char *addr_p)
+{
+	struct sockaddr_storage sa;
+	socklen_t len;
+	int fd, on = 1;
+
+	if (!net_resolve (addr_p, true, &sa, &len))
+		return -1;
+
+	fd = socket (sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		perror ("socket()");
+		return -1;
+	}
+	if (sa.ss_family == AF_UNIX)
+		unlink (((struct sockaddr_un*)&sa)->sun_path);
+	else
+		setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+	if (bind (fd, (struct sockaddr*)&sa, len) == -1) {
+		perror ("bind()");
+		close (fd);
+		return -1;
+	}
+	if (listen (fd, SOMAXCONN) == -1) {
+		perror ("listen()");
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+net_add_node (const char *addr_p)
+{
+	AsmemNode_t *node_p;
+
+	if (netNodeCnt_G == NET_MAXNODES) {
+		printf ("asmem: can't view more than %d nodes\n", NET_MAXNODES);
+		exit (1);
+	}
+	if (netNodes_pG == NULL) {
+		netNodes_pG = (AsmemNode_t*)calloc (NET_MAXNODES, sizeof (AsmemNode_t));
+		if (netNodes_pG == NULL) {
+			perror ("calloc()");
+			exit (1);
+		}
+	}
+
+	node_p = &netNodes_pG[netNodeCnt_G++];
+	safe_copy (node_p->addr, addr_p, sizeof (node_p->addr));
+	safe_copy (node_p->name, addr_p, sizeof (node_p->name));
+	node_p->fd = -1;
+}
+
+/* starts a non-blocking connect, net_service() sees it through */
+static void
+net_connect (AsmemNode_t *node_p)
+{
+	struct sockaddr_storage sa;
+	socklen_t len;
+
+	node_p->retry = sched_now () + (uint64_t)NET_RETRY * NSEC_PER_MSEC;
+	if (!net_resolve (node_p->addr, false, &sa, &len))
+		return;
+
+	node_p->fd = socket (sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (node_p->fd == -1) {
+		perror ("socket()");
+		return;
+	}
+	node_p->connecting = false;
+	node_p->rxLen = 0;
+	if (connect (node_p->fd, (struct sockaddr*)&sa, len) == -1) {
+		if (errno != EINPROGRESS) {
+			VERBOSE ("%s: %s\n", node_p->addr, strerror (errno));
+			net_disconnect (node_p);
+			return;
+		}
+		node_p->connecting = true;
+	}
+}
+
+static void
+net_disconnect (AsmemNode_t *node_p)
+{
+	if (node_p->fd != -1)
+		close (node_p->fd);
+	node_p->fd = -1;
+	node_p->connecting = false;
+	if (node_p->valid) {
+		node_p->valid = false;
+		node_p->dirty = true;
+		netDirty_G = true;
+	}
+}
+
+static void
+net_reconnect (uint64_t now)
+{
+	unsigned i;
+
+	for (i=0; i<netNodeCnt_G; ++i)
+		if (netNodes_pG[i].fd == -1 && now >= netNodes_pG[i].retry)
+			net_connect (&netNodes_pG[i]);
+}
+
+/* when the next node is due to be reconnected [ns, CLOCK_MONOTONIC], UINT64_MAX if none is */
+static uint64_t
+net_retry_time (void)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned i;
+
+	for (i=0; i<netNodeCnt_G; ++i)
+		if (netNodes_pG[i].fd == -1 && netNodes_pG[i].retry < next)
+			next = netNodes_pG[i].retry;
+	return next;
+}
+
+/*
+ * Sends a sample to every client. A frame is far smaller than a socket
+ * buffer, so a client that can't take all of it has stopped reading and
+ * is dropped rather than buffered for.
+ */
+static void
+net_publish (const AsmemMeminfo_t *info_p)
+{
+	unsigned char frame[2 + NET_SAMPLE_LEN], *p = frame;
+	struct timespec now;
+	uint64_t time;
+	uint32_t val;
+	unsigned i, j;
+	int b;
+
+	clock_gettime (CLOCK_REALTIME, &now);
+	time = (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+
+	*p++ = NET_SAMPLE;
+	*p++ = NET_SAMPLE_LEN;
+	for (b=56; b>=0; b-=8)
+		*p++ = (unsigned char)(time >> b);
+	for (j=0; j<MEMINFO_NKEYS; ++j) {
+		val = (uint32_t)*(const unsigned long*)((const char*)info_p + meminfoKeys_G[j].offset);
+		for (b=24; b>=0; b-=8)
+			*p++ = (unsigned char)(val >> b);
+	}
+
+	for (i=0; i<netClientCnt_G; ) {
+		if (send (netClientFd_G[i], frame, sizeof (frame), MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)sizeof (frame)) {
+			++i;
+			continue;
+		}
+		VERBOSE ("dropping client %d\n", netClientFd_G[i]);
+		close (netClientFd_G[i]);
+		netClientFd_G[i] = netClientFd_G[--netClientCnt_G];
+	}
+}
+
+/*
+ * Reads what's there from a node's agent and decodes every complete
+ * frame. Returns false once the connection is gone.
+ */
+static bool
+net_receive (AsmemNode_t *node_p)
+{
+	const unsigned char *p;
+	unsigned len, i, j;
+	ssize_t rtn;
+	uint64_t time;
+	uint32_t val;
+	char c;
+
+	rtn = recv (node_p->fd, node_p->rx + node_p->rxLen, sizeof (node_p->rx) - node_p->rxLen, 0);
+	if (rtn == 0)
+		return false;
+	if (rtn == -1)
+		return errno == EAGAIN || errno == EINTR;
+	node_p->rxLen += (unsigned)rtn;
+
+	while (node_p->rxLen >= 2 && node_p->rxLen >= 2 + (unsigned)node_p->rx[1]) {
+		len = node_p->rx[1];
+		p = node_p->rx + 2;
+
+		if (node_p->rx[0] == NET_HELLO) {
+			// it ends up in the CSV/JSON output, so only plain characters
+			for (i=0, j=0; i<len && j<sizeof (node_p->name) - 1; ++i) {
+				c = (char)p[i];
+				if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '_')
+					node_p->name[j++] = c;
+			}
+			if (j)
+				node_p->name[j] = 0;
+		}
+		else if (node_p->rx[0] == NET_SAMPLE && len >= NET_SAMPLE_MINLEN) {
+			for (time=0, i=0; i<8; ++i)
+				time = time << 8 | *p++;
+			// fields it doesn't send are 0, fields we don't know are skipped
+			memset (&node_p->info, 0, sizeof (node_p->info));
+			for (j=0; j<MEMINFO_NKEYS && j<(len - 8) / 4; ++j) {
+				for (val=0, i=0; i<4; ++i)
+					val = val << 8 | *p++;
+				*(unsigned long*)((char*)&node_p->info + meminfoKeys_G[j].offset) = val;
+			}
+			node_p->time = time;
+			node_p->valid = true;
+			node_p->dirty = true;
+			netDirty_G = true;
+			if (headless_G && outputFd_G != -1)
+				output_sample (node_p->name, time, &node_p->info, NULL);
+		}
+		// unknown frames are skipped, newer agents may send more
+
+		node_p->rxLen -= 2 + len;
+		memmove (node_p->rx, node_p->rx + 2 + len, node_p->rxLen);
+	}
+	return true;
+}
+
+/*
+ * Lists the sockets to wait on: the listening socket and its clients
+ * (agent), then the nodes which are connected or connecting (viewer).
+ */
+static nfds_t
+net_fill_pollfds (struct pollfd *fds_p)
+{
+	nfds_t n = 0;
+	unsigned i;
+
+	if (netListenFd_G != -1) {
+		fds_p[n].fd = netListenFd_G;
+		fds_p[n].events = netClientCnt_G < NET_MAXNODES ? POLLIN : 0;
+		fds_p[n++].revents = 0;
+		for (i=0; i<netClientCnt_G; ++i) {
+			fds_p[n].fd = netClientFd_G[i];
+			fds_p[n].events = POLLIN;
+			fds_p[n++].revents = 0;
+		}
+	}
+	for (i=0; i<netNodeCnt_G; ++i) {
+		fds_p[n].fd = netNodes_pG[i].fd;
+		fds_p[n].events = netNodes_pG[i].connecting ? POLLOUT : POLLIN;
+		fds_p[n++].revents = 0;
+	}
+	return n;
+}
+
+/* handles whatever ppoll() found on the sockets net_fill_pollfds() listed */
+static void
+net_service (struct pollfd *fds_p, nfds_t nfds)
+{
+	AsmemNode_t *node_p;
+	nfds_t n = 0;
+	unsigned i, cnt;
+	int fd, err;
+	socklen_t len;
+	char discard[256];
+
+	if (nfds == 0)
+		return;
+
+	if (netListenFd_G != -1) {
+		/*
+		 * Clients never send anything, so readable means gone. Go
+		 * backwards, dropping one moves the last client into its slot.
+		 */
+		cnt = netClientCnt_G;
+		for (i=cnt; i>0; --i) {
+			if (fds_p[i].revents == 0)
+				continue;
+			if (recv (netClientFd_G[i-1], discard, sizeof (discard), MSG_DONTWAIT) > 0)
+				continue;
+			VERBOSE ("client %d went away\n", netClientFd_G[i-1]);
+			close (netClientFd_G[i-1]);
+			netClientFd_G[i-1] = netClientFd_G[--netClientCnt_G];
+		}
+		n = 1 + cnt;
+
+		if (fds_p[0].revents & POLLIN) {
+			while (netClientCnt_G < NET_MAXNODES) {
+				fd = accept4 (netListenFd_G, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd == -1)
+					break;
+				// say who we are
+				discard[0] = NET_HELLO;
+				discard[1] = (char)strlen (netHostname_G);
+				memcpy (discard + 2, netHostname_G, (size_t)discard[1]);
+				if (send (fd, discard, (size_t)(2 + discard[1]), MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+					close (fd);
+					continue;
+				}
+				VERBOSE ("client %d connected\n", fd);
+				netClientFd_G[netClientCnt_G++] = fd;
+			}
+		}
+	}
+
+	for (i=0; i<netNodeCnt_G && n<nfds; ++i, ++n) {
+		node_p = &netNodes_pG[i];
+		if (fds_p[n].revents == 0 || node_p->fd == -1)
+			continue;
+		if (node_p->connecting) {
+			err = 0;
+			len = sizeof (err);
+			getsockopt (node_p->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+			if (err) {
+				VERBOSE ("%s: %s\n", node_p->addr, strerror (err));
+				net_disconnect (node_p);
+				continue;
+			}
+			VERBOSE ("%s: connected\n", node_p->addr);
+			node_p->connecting = false;
+			continue;
+		}
+		if (!net_receive (node_p)) {
+			VERBOSE ("%s: disconnected\n", node_p->addr);
+			net_disconnect (node_p);
+		}
+	}
+
+	if (netDirty_G && !headless_G) {
+		x11_draw_panel (false);
+		x11_draw_main_win_from_offscreen ();
+	}
+	netDirty_G = false;
+}
+
+static void
+net_cleanup (void)
+{
+	struct sockaddr_storage sa;
+	socklen_t len;
+	unsigned i;
+
+	for (i=0; i<netClientCnt_G; ++i)
+		close (netClientFd_G[i]);
+	netClientCnt_G = 0;
+	if (netListenFd_G != -1) {
+		close (netListenFd_G);
+		netListenFd_G = -1;
+		if (strncmp (netListenAddr_G, "unix:", 5) == 0 && net_resolve (netListenAddr_G, true, &sa, &len))
+			unlink (((struct sockaddr_un*)&sa)->sun_path);
+	}
+	for (i=0; i<netNodeCnt_G; ++i)
+		if (netNodes_pG[i].fd != -1)
+			close (netNodes_pG[i].fd);
+	free (netNodes_pG);
+	netNodes_pG = NULL;
+	netNodeCnt_G = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+// metrics exporter
+/* ------------------------------------------------------------------------- */
+/* val / 10^decimals, in fixed point */
+static char*
+metrics_fixed (char *p, uint64_t val, unsigned decimals)
+{
+	uint64_t div = 1;
+	unsigned i;
+
+	for (i=0; i<decimals; ++i)
+		div *= 10;
+	p = output_ulong (p, (unsigned long)(val / div));
+	*p++ = '.';
+	for (val%=div; div>1; div/=10) {
+		*p++ = (char)('0' + val / (div / 10));
+		val %= div / 10;
+	}
+	return p;
+}
+
+/* the TYPE (and UNIT) lines in front of a metric family */
+static char*
+metrics_family (char *p, const char *name_p, const char *type_p, const char *unit_p)
+{
+	p = stpcpy (p, "# TYPE ");
+	p = stpcpy (p, name_p);
+	*p++ = ' ';
+	p = stpcpy (p, type_p);
+	*p++ = '\n';
+	if (unit_p) {
+		p = stpcpy (p, "# UNIT ");
+		p = stpcpy (p, name_p);
+		*p++ = ' ';
+		p = stpcpy (p, unit_p);
+		*p++ = '\n';
+	}
+	return p;
+}
+
+/* a label value, quoted and escaped: twice its length at most, plus 2 */
+static char*
+metrics_label (char *p, const char *val_p)
+{
+	*p++ = '"';
+	for (; *val_p; ++val_p) {
+		if (*val_p == '"' || *val_p == '\\' || *val_p == '\n')
+			*p++ = '\\';
+		*p++ = *val_p == '\n' ? 'n' : *val_p;
+	}
+	*p++ = '"';
+	return p;
+}
+
+/* one of the self-instrumentation histograms, "tick lateness" as asmem_tick_lateness_seconds */
+static char*
+metrics_hist (char *p, const AsmemHist_t *hist_p)
+{
+	char name[STRSZ * 2], *c_p;
+	uint64_t cnt = 0;
+	unsigned i;
+
+	c_p = stpcpy (name, "asmem_");
+	for (i=0; hist_p->name_p[i] && i<STRSZ; ++i)
+		*c_p++ = hist_p->name_p[i] == ' ' ? '_' : hist_p->name_p[i];
+	stpcpy (c_p, "_seconds");
+
+	p = metrics_family (p, name, "histogram", "seconds");
+	for (i=0; i<STATS_BUCKETS; ++i) {
+		cnt += hist_p->bucket[i];
+		p = stpcpy (p, name);
+		p = stpcpy (p, "_bucket{le=\"");
+		p = i < STATS_BUCKETS - 1 ? metrics_fixed (p, 2ul << i, 6) : stpcpy (p, "+Inf");
+		p = stpcpy (p, "\"} ");
+		p = output_ulong (p, (unsigned long)cnt);
+		*p++ = '\n';
+	}
+	p = stpcpy (p, name);
+	p = stpcpy (p, "_count ");
+	p = output_ulong (p, (unsigned long)hist_p->count);
+	*p++ = '\n';
+	p = stpcpy (p, name);
+	p = stpcpy (p, "_sum ");
+	p = metrics_fixed (p, hist_p->sum, 9);
+	*p++ = '\n';
+	return p;
+}
+
+/*
+ * Renders the response to a scrape, after every sample, into the buffer
+ * which isn't current and makes it current. The HTTP header is written
+ * in front of the body, so the response is in one piece. Scrapes still
+ * being sent the other one are a whole sample behind, and are dropped.
+ */
+static void
+metrics_render (void)
+{
+	static const char *counterName_p[] = {"samples", "redraws", "skipped_redraws", "empty_updates", "x_events",
+			"x_requests", "x_bytes", "scrapes", "alerts_dropped", "records_dropped"};
+	unsigned long counter[] = {statsSamples_G, statsRedraws_G, statsSkipped_G, statsEmpty_G, statsXEvents_G,
+			statsXRequests_G, statsXBytes_G, metricsScrapes_G, alertDropped_G, recDropped_G};
+	const AsmemMonitor_t *mon_p;
+	char *body_p, *p, *end_p, name[STRSZ * 2], head[METRICS_HEADSZ];
+	unsigned spare = metricsCur_G ^ 1, i;
+	struct timespec now;
+	double rate;
+	int len;
+
+	for (i=metricsClientCnt_G; i>0; --i)
+		if (metricsClients_G[i-1].buf == (int)spare)
+			metrics_drop (i - 1);
+
+	// everything is checked for METRICS_ROOM before it's written
+	body_p = p = metricsBuf_G[spare] + METRICS_HEADSZ;
+	end_p = metricsBuf_G[spare] + METRICS_BUFSZ - METRICS_ROOM;
+	for (i=0; i<MEMINFO_NKEYS && p<end_p; ++i) {
+		stpcpy (stpcpy (stpcpy (name, "asmem_memory_"), meminfoKeys_G[i].key_p), "_bytes");
+		p = metrics_family (p, name, "gauge", "bytes");
+		for (mon_p=monitors_G; mon_p<monitors_G+monitorCnt_G && p<end_p; ++mon_p) {
+			p = stpcpy (p, name);
+			p = stpcpy (p, "{dev=");
+			p = metrics_label (p, mon_p->filename);
+			p = stpcpy (p, "} ");
+			// the values are kB/1000
+			p = output_ulong (p, *(const unsigned long*)((const char*)&mon_p->fresh + meminfoKeys_G[i].offset) * 1024000);
+			*p++ = '\n';
+		}
+	}
+	// --trend: bytes per second, and seconds until RAM + swap run out (+Inf if never)
+	if (trend_G && p < end_p) {
+		p = metrics_family (p, "asmem_growth_bytes_per_second", "gauge", "bytes_per_second");
+		for (mon_p=monitors_G; mon_p<monitors_G+monitorCnt_G && p<end_p; ++mon_p) {
+			p = stpcpy (p, "asmem_growth_bytes_per_second{dev=");
+			p = metrics_label (p, mon_p->filename);
+			p = stpcpy (p, "} ");
+			rate = mon_p->trends.series[trALL].rate * 1024000;
+			if (rate <= -1)
+				*p++ = '-';
+			p = output_ulong (p, (unsigned long)(rate < 0 ? -rate : rate));
+			*p++ = '\n';
+		}
+		p = metrics_family (p, "asmem_exhaustion_seconds", "gauge", "seconds");
+		for (mon_p=monitors_G; mon_p<monitors_G+monitorCnt_G && p<end_p; ++mon_p) {
+			p = stpcpy (p, "asmem_exhaustion_seconds{dev=");
+			p = metrics_label (p, mon_p->filename);
+			p = stpcpy (p, "} ");
+			p = mon_p->trends.eta >= 0 ? output_ulong (p, (unsigned long)mon_p->trends.eta) : stpcpy (p, "+Inf");
+			*p++ = '\n';
+		}
+	}
+	// --swaps: every device, and what the compressed swap holds and takes
+	if (swaps_G && p < end_p) {
+		p = metrics_family (p, "asmem_swap_device_used_bytes", "gauge", "bytes");
+		for (i=0; i<swapDevCnt_G && p<end_p; ++i) {
+			p = stpcpy (p, "asmem_swap_device_used_bytes{device=");
+			p = metrics_label (p, swapDevs_G[i].path);
+			p = stpcpy (p, ",type=");
+			p = metrics_label (p, swapDevs_G[i].mmStatFd != -1 ? "zram" : swapDevs_G[i].type);
+			p = stpcpy (p, "} ");
+			p = output_ulong (p, swapDevs_G[i].used * 1024000);
+			*p++ = '\n';
+		}
+		p = metrics_family (p, "asmem_swap_compressed_stored_bytes", "gauge", "bytes");
+		p = stpcpy (p, "asmem_swap_compressed_stored_bytes ");
+		p = output_ulong (p, swapsOrig_G * 1024000);
+		*p++ = '\n';
+		p = metrics_family (p, "asmem_swap_compressed_memory_bytes", "gauge", "bytes");
+		p = stpcpy (p, "asmem_swap_compressed_memory_bytes ");
+		p = output_ulong (p, swapsCompr_G * 1024000);
+		*p++ = '\n';
+	}
+	if (p < end_p) {
+		clock_gettime (CLOCK_REALTIME, &now);
+		p = metrics_family (p, "asmem_sample_timestamp_seconds", "gauge", "seconds");
+		p = stpcpy (p, "asmem_sample_timestamp_seconds ");
+		p = metrics_fixed (p, (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / NSEC_PER_MSEC, 3);
+		*p++ = '\n';
+	}
+	for (i=0; i<sizeof (counter) / sizeof (counter[0]) && p<end_p; ++i) {
+		stpcpy (stpcpy (name, "asmem_"), counterName_p[i]);
+		p = metrics_family (p, name, "counter", NULL);
+		p = stpcpy (p, name);
+		p = stpcpy (p, "_total ");
+		p = output_ulong (p, counter[i]);
+		*p++ = '\n';
+	}
+	for (i=0; i<sizeof (statsHists_G) / sizeof (statsHists_G[0]) && p<end_p; ++i)
+		p = metrics_hist (p, statsHists_G[i]);
+
+	// whatever ran out of room left the rest undone
+	if (i < sizeof (statsHists_G) / sizeof (statsHists_G[0])) {
+		VERBOSE ("the metrics don't fit into %d bytes\n", METRICS_BUFSZ);
+		metricsLen_G[spare] = 0;
+	}
+	else {
+		p = stpcpy (p, "# EOF\n");
+		len = snprintf (head, sizeof (head), "HTTP/1.0 200 OK\r\n"
+				"Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+				"Content-Length: %lu\r\n\r\n", (unsigned long)(p - body_p));
+		memcpy (body_p - len, head, (size_t)len);
+		metricsResponse_pG[spare] = body_p - len;
+		metricsLen_G[spare] = (size_t)(p - body_p) + (size_t)len;
+	}
+	metricsCur_G = spare;
+}
+
+static void
+metrics_drop (unsigned i)
+{
+	close (metricsClients_G[i].fd);
+	metricsClients_G[i] = metricsClients_G[--metricsClientCnt_G];
+}
+
+/* picks the response to a complete request, only its first line counts */
+static void
+metrics_respond (AsmemScrape_t *scrape_p)
+{
+	static const char notAllowed[] = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n";
+	static const char notFound[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+	static const char unavailable[] = "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+	const char *path_p = scrape_p->rx + 4;
+
+	scrape_p->buf = -1;
+	if (strncmp (scrape_p->rx, "GET ", 4) != 0) {
+		scrape_p->tx_p = notAllowed;
+		scrape_p->txLen = sizeof (notAllowed) - 1;
+	}
+	else if (strncmp (path_p, "/ ", 2) != 0 && (strncmp (path_p, "/metrics", 8) != 0 || (path_p[8] != ' ' && path_p[8] != '?'))) {
+		scrape_p->tx_p = notFound;
+		scrape_p->txLen = sizeof (notFound) - 1;
+	}
+	else if (metricsLen_G[metricsCur_G] == 0) {
+		scrape_p->tx_p = unavailable;
+		scrape_p->txLen = sizeof (unavailable) - 1;
+	}
+	else {
+		scrape_p->buf = (int)metricsCur_G;
+		scrape_p->tx_p = metricsResponse_pG[metricsCur_G];
+		scrape_p->txLen = metricsLen_G[metricsCur_G];
+		++metricsScrapes_G;
+	}
+}
+
+/*
+ * The listening socket, then each scrape: reading its request or
+ * sending. Scrapes which have taken too long are dropped first.
+ */
+static nfds_t
+metrics_fill_pollfds (struct pollfd *fds_p, uint64_t now)
+{
+	nfds_t n = 0;
+	unsigned i;
+
+	if (metricsListenFd_G == -1)
+		return 0;
+	for (i=metricsClientCnt_G; i>0; --i)
+		if (now - metricsClients_G[i-1].since >= (uint64_t)METRICS_TIMEOUT * NSEC_PER_MSEC)
+			metrics_drop (i - 1);
+	fds_p[n].fd = metricsListenFd_G;
+	fds_p[n].events = metricsClientCnt_G < METRICS_MAXCLIENTS ? POLLIN : 0;
+	fds_p[n++].revents = 0;
+	for (i=0; i<metricsClientCnt_G; ++i) {
+		fds_p[n].fd = metricsClients_G[i].fd;
+		fds_p[n].events = metricsClients_G[i].tx_p == NULL ? POLLIN : POLLOUT;
+		fds_p[n++].revents = 0;
+	}
+	return n;
+}
+
+/* when the oldest scrape times out [ns, CLOCK_MONOTONIC], UINT64_MAX if there's none */
+static uint64_t
+metrics_timeout (void)
+{
+	uint64_t oldest = UINT64_MAX;
+	unsigned i;
+
+	for (i=0; i<metricsClientCnt_G; ++i)
+		if (metricsClients_G[i].since < oldest)
+			oldest = metricsClients_G[i].since;
+	return oldest == UINT64_MAX ? oldest : oldest + (uint64_t)METRICS_TIMEOUT * NSEC_PER_MSEC;
+}
+
+/*
+ * Moves the scrapes metrics_fill_pollfds() listed along as far as their
+ * sockets allow, then takes on new ones. A scrape is closed once its
+ * response is out, as HTTP/1.0 has it.
+ */
+static void
+metrics_service (struct pollfd *fds_p, nfds_t nfds)
+{
+	AsmemScrape_t *scrape_p;
+	ssize_t rtn;
+	nfds_t n;
+	unsigned i;
+	int fd;
+
+	if (nfds == 0)
+		return;
+
+	for (n=1; n<nfds; ++n) {
+		if (fds_p[n].revents == 0)
+			continue;
+		// a sample since the list was made may have dropped some
+		for (i=0; i<metricsClientCnt_G && metricsClients_G[i].fd != fds_p[n].fd; ++i)
+			;
+		if (i == metricsClientCnt_G)
+			continue;
+		scrape_p = &metricsClients_G[i];
+
+		if (scrape_p->tx_p == NULL) {
+			rtn = recv (scrape_p->fd, scrape_p->rx + scrape_p->rxLen, sizeof (scrape_p->rx) - 1 - scrape_p->rxLen, 0);
+			if (rtn == -1 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (rtn <= 0 || (scrape_p->rxLen += (unsigned)rtn) == sizeof (scrape_p->rx) - 1) {
+				metrics_drop (i);
+				continue;
+			}
+			scrape_p->rx[scrape_p->rxLen] = 0;
+			if (strstr (scrape_p->rx, "\r\n\r\n") == NULL && strstr (scrape_p->rx, "\n\n") == NULL)
+				continue;
+			metrics_respond (scrape_p);
+		}
+
+		rtn = send (scrape_p->fd, scrape_p->tx_p, scrape_p->txLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rtn == -1 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (rtn > 0 && (size_t)rtn < scrape_p->txLen) {
+			scrape_p->tx_p += rtn;
+			scrape_p->txLen -= (size_t)rtn;
+			continue;
+		}
+		metrics_drop (i);
+	}
+
+	if (fds_p[0].revents & POLLIN) {
+		while (metricsClientCnt_G < METRICS_MAXCLIENTS) {
+			fd = accept4 (metricsListenFd_G, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd == -1)
+				break;
+			scrape_p = &metricsClients_G[metricsClientCnt_G++];
+			scrape_p->fd = fd;
+			scrape_p->since = sched_now ();
+			scrape_p->rxLen = 0;
+			scrape_p->buf = -1;
+			scrape_p->tx_p = NULL;
+			scrape_p->txLen = 0;
+		}
+	}
+}
+
+static void
+metrics_cleanup (void)
+{
+	struct sockaddr_storage sa;
+	socklen_t len;
+
+	while (metricsClientCnt_G)
+		metrics_drop (metricsClientCnt_G - 1);
+	if (metricsListenFd_G != -1) {
+		close (metricsListenFd_G);
+		metricsListenFd_G = -1;
+		if (strncmp (metricsAddr_G, "unix:", 5) == 0 && net_resolve (metricsAddr_G, true, &sa, &len))
+			unlink (((struct sockaddr_un*)&sa)->sun_path);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+// shared memory
+/* ------------------------------------------------------------------------- */
+/*
+ * Creates (or takes over) the segment. An existing file is reused rather
+ * than replaced, so that subscribers still mapping it carry on when a
+ * publisher is restarted; the lock keeps out a second one.
+ */
+static bool
+shm_publisher_open (void)
+{
+	unsigned i;
+
+	if ((shmFd_G = open (shmFilename_G, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	if (flock (shmFd_G, LOCK_EX | LOCK_NB) == -1) {
+		printf ("asmem: %s is already being published to\n", shmFilename_G);
+		return false;
+	}
+	if (ftruncate (shmFd_G, sizeof (AsmemShm_t)) == -1) {
+		perror ("ftruncate()");
+		return false;
+	}
+	shm_pG = (AsmemShm_t*)mmap (NULL, sizeof (AsmemShm_t), PROT_READ | PROT_WRITE, MAP_SHARED, shmFd_G, 0);
+	if (shm_pG == MAP_FAILED) {
+		shm_pG = NULL;
+		perror ("mmap()");
+		return false;
+	}
+
+	// seq is left alone, subscribers are waiting on its current value
+	shm_pG->version = SHM_VERSION;
+	shm_pG->interval = (uint32_t)updateInterval_G;
+	shm_pG->fieldCnt = MEMINFO_NKEYS;
+	shm_pG->pid = (uint32_t)getpid ();
+	for (i=0; i<MEMINFO_NKEYS; ++i)
+		shm_pG->field[i] = 0;
+	__atomic_store_n (&shm_pG->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	VERBOSE ("publishing to %s\n", shmFilename_G);
+	return true;
+}
+
+/* maps the segment and starts the thread that waits for its samples */
+static bool
+shm_subscriber_open (void)
+{
+	struct stat st;
+	pthread_t thread;
+	sigset_t all, old;
+	int rtn;
+
+	if ((shmFd_G = open (shmFilename_G, O_RDONLY | O_CLOEXEC)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	if (fstat (shmFd_G, &st) == -1 || st.st_size < (off_t)sizeof (AsmemShm_t)) {
+		printf ("asmem: %s isn't published to\n", shmFilename_G);
+		return false;
+	}
+	shm_pG = (AsmemShm_t*)mmap (NULL, sizeof (AsmemShm_t), PROT_READ, MAP_SHARED, shmFd_G, 0);
+	if (shm_pG == MAP_FAILED) {
+		shm_pG = NULL;
+		perror ("mmap()");
+		return false;
+	}
+	if (__atomic_load_n (&shm_pG->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || shm_pG->version != SHM_VERSION) {
+		printf ("asmem: %s isn't published to by this version of asmem\n", shmFilename_G);
+		return false;
+	}
+	shmFieldCnt_G = shm_pG->fieldCnt < MEMINFO_NKEYS ? shm_pG->fieldCnt : MEMINFO_NKEYS;
+
+	if ((shmEventFd_G = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		perror ("eventfd()");
+		return false;
+	}
+	// signals are for the main thread
+	sigfillset (&all);
+	pthread_sigmask (SIG_SETMASK, &all, &old);
+	rtn = pthread_create (&thread, NULL, shm_waiter, NULL);
+	pthread_sigmask (SIG_SETMASK, &old, NULL);
+	if (rtn != 0) {
+		printf ("asmem: can't start a thread: %s\n", strerror (rtn));
+		return false;
+	}
+	pthread_detach (thread);
+	// a segment left behind by a publisher that's gone isn't read at all
+	shm_watch (sched_now ());
+	VERBOSE ("subscribed to %s (pid %u, every %u ms)\n", shmFilename_G, shm_pG->pid, shm_pG->interval);
+	return true;
+}
+
+/*
+ * Writes one sample under the seqlock (seq is odd while the fields are
+ * inconsistent) and wakes everybody waiting on it.
+ */
+static void
+shm_publish (const AsmemMeminfo_t *info_p)
+{
+	struct timespec now;
+	uint32_t seq;
+	unsigned i;
+
+	clock_gettime (CLOCK_REALTIME, &now);
+	// a publisher which died half-way left seq odd
+	seq = shm_pG->seq | 1;
+	__atomic_store_n (&shm_pG->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	shm_pG->time = (uint64_t)now.tv_sec * NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+	// --adaptive moves it, and subscribers time the publisher out by it
+	shm_pG->interval = (uint32_t)schedInterval_G;
+	for (i=0; i<MEMINFO_NKEYS; ++i)
+		shm_pG->field[i] = *(const unsigned long*)((const char*)info_p + meminfoKeys_G[i].offset);
+	__atomic_store_n (&shm_pG->seq, seq + 1, __ATOMIC_RELEASE);
+	syscall (SYS_futex, &shm_pG->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Copies the latest sample into info_p without taking any lock: the copy
+ * is retried if seq moved while it was being made. Returns false (and
+ * leaves info_p alone) if the publisher never finishes the one it's on.
+ */
+static bool
+shm_read (AsmemMeminfo_t *info_p)
+{
+	uint64_t field[MEMINFO_NKEYS];
+	uint32_t seq;
+	unsigned i, spins = 0;
+
+	while (1) {
+		seq = __atomic_load_n (&shm_pG->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			if (++spins == SHM_SPINS) {
+				VERBOSE ("%s: the publisher is stuck\n", shmFilename_G);
+				return false;
+			}
+			sched_yield ();
+			continue;
+		}
+		memcpy (field, shm_pG->field, sizeof (field));
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (__atomic_load_n (&shm_pG->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	memset (info_p, 0, sizeof (*info_p));
+	for (i=0; i<shmFieldCnt_G; ++i)
+		*(unsigned long*)((char*)info_p + meminfoKeys_G[i].offset) = (unsigned long)field[i];
+	return true;
+}
+
+/* turns the publisher's futex wakeups into a readable shmEventFd_G */
+static void*
+shm_waiter (void *arg_p)
+{
+	uint32_t seq, next;
+	uint64_t one = 1;
+
+	(void)arg_p;
+	seq = __atomic_load_n (&shm_pG->seq, __ATOMIC_ACQUIRE);
+	while (1) {
+		syscall (SYS_futex, &shm_pG->seq, FUTEX_WAIT, seq, NULL, NULL, 0);
+		if ((next = __atomic_load_n (&shm_pG->seq, __ATOMIC_ACQUIRE)) == seq)
+			continue;
+		// an odd seq is waited on in turn, the wakeup comes with the even one
+		seq = next;
+		if ((seq & 1) == 0 && write (shmEventFd_G, &one, sizeof (one)) == -1 && errno != EAGAIN)
+			break;
+	}
+	return NULL;
+}
+
+/* whether samples come from a publisher, rather than from /proc/meminfo */
+static bool
+shm_subscribed (void)
+{
+	return shmEventFd_G != -1 && !shmStale_G;
+}
+
+/* the publisher has a new sample: it's back if it was gone, and checked on again later */
+static void
+shm_received (uint64_t now)
+{
+	uint32_t interval = __atomic_load_n (&shm_pG->interval, __ATOMIC_RELAXED);
+
+	if (shmStale_G) {
+		printf ("asmem: %s is published to again\n", shmFilename_G);
+		shmStale_G = false;
+	}
+	shmCheck_G = now + (uint64_t)SHM_STALE * (interval ? interval : 1) * NSEC_PER_MSEC;
+}
+
+/*
+ * Called once the publisher has had SHM_STALE intervals to publish a
+ * sample and hasn't: it's given up on if its process is gone or its
+ * latest sample is that old, and checked on again later otherwise.
+ */
+static void
+shm_watch (uint64_t now)
+{
+	uint32_t interval = __atomic_load_n (&shm_pG->interval, __ATOMIC_RELAXED);
+	uint64_t time = __atomic_load_n (&shm_pG->time, __ATOMIC_RELAXED), stale, age;
+	struct timespec real;
+
+	if (now < shmCheck_G)
+		return;
+	stale = (uint64_t)SHM_STALE * (interval ? interval : 1) * NSEC_PER_MSEC;
+	clock_gettime (CLOCK_REALTIME, &real);
+	age = (uint64_t)real.tv_sec * NSEC_PER_SEC + (uint64_t)real.tv_nsec;
+	age = age > time ? age - time : 0;
+	if (kill ((pid_t)__atomic_load_n (&shm_pG->pid, __ATOMIC_RELAXED), 0) == -1 && errno == ESRCH)
+		shm_lost ("has no publisher");
+	else if (age >= stale)
+		shm_lost ("has no new samples");
+	else
+		shmCheck_G = now + stale;
+}
+
+/* stops taking samples from the publisher until it has a new one */
+static void
+shm_lost (const char *why_p)
+{
+	printf ("asmem: %s %s, reading %s\n", shmFilename_G, why_p, mon_pG->filename);
+	shmStale_G = true;
+}
+
+/*
+ * The file stays, for the subscribers of a restarted publisher. A
+ * subscriber's mapping and eventfd are left to exit(): the waiter thread
+ * is still asleep on them.
+ */
+static void
+shm_cleanup (void)
+{
+	if (!shmPublish_G || shm_pG == NULL)
+		return;
+	munmap (shm_pG, sizeof (AsmemShm_t));
+	shm_pG = NULL;
+	close (shmFd_G);
+	shmFd_G = -1;
+}
+
+/* ------------------------------------------------------------------------- */
+// alerts
+/* ------------------------------------------------------------------------- */
+/* parses "<metric><op><limit>[%]", e.g. "avail<5%", into the next rule */
+static bool
+alert_add (const char *rule_p)
+{
+	static const char *metrics[alCOUNT] = {"avail", "used", "swap", "growth"};
+	AsmemAlert_t *alert_p;
+	const char *limit_p;
+	char *end_p;
+	double limit;
+	size_t len = 0;
+	unsigned i;
+
+	if (alertCnt_G == ALERT_MAX) {
+		printf ("asmem: at most %u --alert rules\n", ALERT_MAX);
+		return false;
+	}
+	for (i=0; i<alCOUNT; ++i) {
+		len = strlen (metrics[i]);
+		if (strncmp (rule_p, metrics[i], len) == 0 && (rule_p[len] == '<' || rule_p[len] == '>'))
+			break;
+	}
+	if (i == alCOUNT) {
+		printf ("asmem: bad --alert %s, it starts with avail, used, swap or growth, then < or >\n", rule_p);
+		return false;
+	}
+	limit_p = rule_p + len + 1;
+	limit = strtod (limit_p, &end_p);
+	if (end_p != limit_p && *end_p == '%' && i != alGROWTH)
+		++end_p;
+	if (end_p == limit_p || *end_p != 0 || limit < 0 || limit > 1e12) {
+		printf ("asmem: bad limit in --alert %s\n", rule_p);
+		return false;
+	}
+
+	alert_p = &alerts_G[alertCnt_G++];
+	safe_copy (alert_p->text, rule_p, sizeof (alert_p->text));
+	alert_p->metric = i;
+	alert_p->above = (rule_p[len] == '>');
+	alert_p->limit = (unsigned long)(limit * 1000.0 + 0.5);
+	if (alert_p->above)
+		alert_p->clear = alert_p->limit - alert_p->limit / ALERT_HYST_DIV;
+	else
+		alert_p->clear = alert_p->limit + alert_p->limit / ALERT_HYST_DIV;
+	return true;
+}
+
+/*
+ * Forks the process which runs --alert-exec. Forking a small process
+ * once, before the display is opened and any threads are started, keeps
+ * fork() and its page table copy out of the sampling loop.
+ */
+static bool
+alert_helper_start (void)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe2 (fds, O_CLOEXEC) == -1) {
+		perror ("pipe2()");
+		return false;
+	}
+	if ((pid = fork ()) == -1) {
+		perror ("fork()");
+		return false;
+	}
+	if (pid == 0) {
+		close (fds[1]);
+		alert_helper (fds[0]);
+	}
+	close (fds[0]);
+	alertHelperFd_G = fds[1];
+	fcntl (alertHelperFd_G, F_SETFL, O_NONBLOCK);
+	VERBOSE ("alert helper is pid %d\n", (int)pid);
+	return true;
+}
+
+/* the helper: runs the command for every message, until asmem goes away */
+static void
+alert_helper (int fd)
+{
+	AsmemAlertMsg_t msg;
+
+	// not ours to handle, and the commands are reaped by the kernel
+	signal (SIGINT, SIG_IGN);
+	signal (SIGUSR1, SIG_IGN);
+	signal (SIGCHLD, SIG_IGN);
+	prctl (PR_SET_NAME, "asmem-alert");
+	while (read (fd, &msg, sizeof (msg)) == (ssize_t)sizeof (msg)) {
+		msg.rule[sizeof (msg.rule) - 1] = 0;
+		msg.value[sizeof (msg.value) - 1] = 0;
+		msg.dev[sizeof (msg.dev) - 1] = 0;
+		if (fork () != 0)
+			continue;
+		signal (SIGINT, SIG_DFL);
+		signal (SIGCHLD, SIG_DFL);
+		setenv ("ASMEM_ALERT", msg.rule, 1);
+		setenv ("ASMEM_STATE", msg.on ? "on" : "off", 1);
+		setenv ("ASMEM_VALUE", msg.value, 1);
+		setenv ("ASMEM_DEV", msg.dev, 1);
+		execl ("/bin/sh", "sh", "-c", alertExec_G, (char*)NULL);
+		_exit (127);
+	}
+	_exit (0);
+}
+
+/* opened read-write so that it never blocks, nor fails for want of a reader */
+static bool
+alert_fifo_open (void)
+{
+	if (mkfifo (alertFifo_G, 0644) == -1 && errno != EEXIST) {
+		perror ("mkfifo()");
+		return false;
+	}
+	if ((alertFifoFd_G = open (alertFifo_G, O_RDWR | O_APPEND | O_NONBLOCK | O_CLOEXEC)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Runs the rules against the current monitor's fresh sample. All values
+ * are in thousandths of their unit. A rule turns on once it has been past
+ * its limit for ALERT_DEBOUNCE samples in a row, and off once it has been
+ * back past its clear level for as long.
+ */
+static void
+alert_check (void)
+{
+	const AsmemMeminfo_t *info_p = &mon_pG->fresh;
+	const AsmemAlert_t *alert_p;
+	unsigned long val[alCOUNT], avail, used, swapUsed;
+	uint64_t now = sched_now ();
+	unsigned i;
+	bool on, past;
+
+	avail = meminfo_available (info_p);
+	used = info_p->memTotal - avail;
+	swapUsed = info_p->swapTotal > info_p->swapFree ? info_p->swapTotal - info_p->swapFree : 0;
+	val[alAVAIL] = info_p->memTotal ? avail * 100000 / info_p->memTotal : 0;
+	val[alUSED] = info_p->memTotal ? used * 100000 / info_p->memTotal : 0;
+	val[alSWAP] = info_p->swapTotal ? swapUsed * 100000 / info_p->swapTotal : 0;
+	val[alGROWTH] = 0;
+	if (mon_pG->alertTime != 0 && used > mon_pG->alertUsed && now > mon_pG->alertTime)
+		val[alGROWTH] = (unsigned long)((uint64_t)(used - mon_pG->alertUsed) * 1000 * NSEC_PER_SEC / (now - mon_pG->alertTime));
+	mon_pG->alertUsed = used;
+	mon_pG->alertTime = now;
+
+	for (i=0; i<alertCnt_G; ++i) {
+		alert_p = &alerts_G[i];
+		on = (mon_pG->alertOn >> i) & 1;
+		if (on)
+			past = alert_p->above ? val[alert_p->metric] <= alert_p->clear : val[alert_p->metric] >= alert_p->clear;
+		else
+			past = alert_p->above ? val[alert_p->metric] > alert_p->limit : val[alert_p->metric] < alert_p->limit;
+		if (!past) {
+			mon_pG->alertRun[i] = 0;
+			continue;
+		}
+		if (++mon_pG->alertRun[i] < ALERT_DEBOUNCE)
+			continue;
+		mon_pG->alertRun[i] = 0;
+		mon_pG->alertOn ^= 1u << i;
+		alert_fire (i, !on, val[alert_p->metric]);
+	}
+}
+
+/* carries out the actions for a rule which just flipped */
+static void
+alert_fire (unsigned rule, bool on, unsigned long value)
+{
+	AsmemAlertMsg_t msg;
+	struct timespec now;
+	char line[FNAMESZ + 128];
+	int len;
+
+	VERBOSE ("%s: %s %s at %lu.%lu\n", mon_pG->filename, alerts_G[rule].text, on ? "on" : "off", value / 1000, value % 1000 / 100);
+	if (dpy_pG != NULL)
+		x11_set_urgency (mon_pG->alertOn != 0);
+
+	if (alertHelperFd_G != -1) {
+		memset (&msg, 0, sizeof (msg));
+		safe_copy (msg.rule, alerts_G[rule].text, sizeof (msg.rule));
+		safe_copy (msg.dev, mon_pG->filename, sizeof (msg.dev));
+		snprintf (msg.value, sizeof (msg.value), "%lu.%lu", value / 1000, value % 1000 / 100);
+		msg.on = on;
+		if (write (alertHelperFd_G, &msg, sizeof (msg)) != (ssize_t)sizeof (msg))
+			++alertDropped_G;
+	}
+
+	if (alertFifoFd_G != -1) {
+		clock_gettime (CLOCK_REALTIME, &now);
+		len = snprintf (line, sizeof (line), "%lld %s %s %lu.%lu %s\n", (long long)now.tv_sec,
+				alerts_G[rule].text, on ? "on" : "off", value / 1000, value % 1000 / 100, mon_pG->filename);
+		if (len > 0 && write (alertFifoFd_G, line, (size_t)len) != len)
+			++alertDropped_G;
+	}
+}
+
+/* the helper exits when its end of the pipe is closed */
+static void
+alert_cleanup (void)
+{
+	if (alertHelperFd_G != -1) {
+		close (alertHelperFd_G);
+		alertHelperFd_G = -1;
+	}
+	if (alertFifoFd_G != -1) {
+		close (alertFifoFd_G);
+		alertFifoFd_G = -1;
+	}
+	if (alertDropped_G)
+		VERBOSE ("%lu alert actions dropped\n", alertDropped_G);
+}
+
+/* ------------------------------------------------------------------------- */
+// trends
+/* ------------------------------------------------------------------------- */
+/*
+ * Folds a sample taken at time [ns] into the statistics, in constant
+ * time and memory: for every field (and the tr* totals) an exponentially
+ * weighted average and growth rate, whose weight depends on how long
+ * it's been since the last sample so that they don't depend on the
+ * interval, and the smallest and largest value of each TREND_SPAN. The
+ * time to exhaustion projects the growth of what isn't available (swap
+ * included) onto RAM + swap. Samples which don't move time on are left
+ * out.
+ */
+static void
+trend_update (AsmemTrends_t *trends_p, const AsmemMeminfo_t *info_p, uint64_t time)
+{
+	unsigned long val[trCOUNT], total;
+	uint64_t id = time / (TREND_SPAN * NSEC_PER_SEC) + 1;
+	unsigned i, b = (unsigned)(id % TREND_BUCKETS);
+	AsmemTrend_t *series_p;
+	double dt, alpha;
+	bool first = (trends_p->time == 0), reset;
+
+	if (!first && time <= trends_p->time)
+		return;
+	for (i=0; i<MEMINFO_NKEYS; ++i)
+		val[i] = *(const unsigned long*)((const char*)info_p + meminfoKeys_G[i].offset);
+	val[trRAM] = meminfo_used (info_p);
+	val[trSWAP] = info_p->swapFree < info_p->swapTotal ? info_p->swapTotal - info_p->swapFree : 0;
+	val[trALL] = info_p->memTotal - meminfo_available (info_p) + val[trSWAP];
+
+	dt = first ? 0 : (double)(time - trends_p->time) / (double)NSEC_PER_SEC;
+	alpha = dt / (TREND_TAU + dt);
+	// a bucket last used TREND_BUCKETS spans ago starts over
+	reset = (trends_p->bucket[b] != id);
+	trends_p->bucket[b] = id;
+	for (i=0; i<trCOUNT; ++i) {
+		series_p = &trends_p->series[i];
+		if (first)
+			series_p->ewma = (double)val[i];
+		else {
+			series_p->ewma += alpha * ((double)val[i] - series_p->ewma);
+			series_p->rate += alpha * (((double)val[i] - (double)series_p->last) / dt - series_p->rate);
+		}
+		series_p->last = val[i];
+		if (reset || val[i] < series_p->min[b])
+			series_p->min[b] = val[i];
+		if (reset || val[i] > series_p->max[b])
+			series_p->max[b] = val[i];
+	}
+	trends_p->time = time;
+
+	total = info_p->memTotal + info_p->swapTotal;
+	if (trends_p->series[trALL].rate <= 0)
+		trends_p->eta = -1;
+	else if (val[trALL] >= total)
+		trends_p->eta = 0;
+	else
+		trends_p->eta = (double)(total - val[trALL]) / trends_p->series[trALL].rate;
+}
+
+/* the smallest and largest value of a series in the last TREND_BUCKETS spans */
+static void
+trend_range (const AsmemTrends_t *trends_p, unsigned series, unsigned long *min_p, unsigned long *max_p)
+{
+	const AsmemTrend_t *series_p = &trends_p->series[series];
+	uint64_t id = trends_p->time / (TREND_SPAN * NSEC_PER_SEC) + 1;
+	unsigned b;
+
+	*min_p = ULONG_MAX;
+	*max_p = 0;
+	for (b=0; b<TREND_BUCKETS; ++b) {
+		if (trends_p->bucket[b] == 0 || trends_p->bucket[b] + TREND_BUCKETS <= id)
+			continue;
+		if (series_p->min[b] < *min_p)
+			*min_p = series_p->min[b];
+		if (series_p->max[b] > *max_p)
+			*max_p = series_p->max[b];
+	}
+	if (*min_p > *max_p)
+		*min_p = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+// recorder
+/* ------------------------------------------------------------------------- */
+/* 8 bits of a rotating checksum, over a record's length byte and payload */
+static uint8_t
+rec_check (const uint8_t *p, size_t len)
+{
+	uint8_t sum = 0x5a;
+
+	while (len--)
+		sum = (uint8_t)(((sum << 1) | (sum >> 7)) ^ *p++);
+	return sum;
+}
+
+/* LEB128: 7 bits a byte, the least significant first */
+static uint8_t*
+rec_put_varint (uint8_t *p, uint64_t val)
+{
+	while (val >= 0x80) {
+		*p++ = (uint8_t)(val | 0x80);
+		val >>= 7;
+	}
+	*p++ = (uint8_t)val;
+	return p;
+}
+
+static bool
+rec_get_varint (const uint8_t **p_p, const uint8_t *end_p, uint64_t *val_p)
+{
+	const uint8_t *p = *p_p;
+	uint64_t val = 0;
+	unsigned shift;
+
+	for (shift=0; p<end_p && shift<64; shift+=7) {
+		val |= (uint64_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0) {
+			*p_p = p;
+			*val_p = val;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Creates the file, or carries on with the ring in it: recording resumes
+ * in the block after the newest, which may have been left half-written.
+ * The samples come from rec_push() through the recorder thread.
+ */
+static bool
+rec_open (void)
+{
+	const AsmemRecBlock_t *block_p;
+	struct stat st;
+	sigset_t all, old;
+	unsigned blockCnt, i;
+	int rtn;
+
+	blockCnt = (unsigned)((uint64_t)recSize_G * 1024 * 1024 / REC_BLOCKSZ);
+	recMapSz_G = (size_t)(blockCnt + 1) * REC_BLOCKSZ;
+	if ((recFd_G = open (recFilename_G, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	if (flock (recFd_G, LOCK_EX | LOCK_NB) == -1) {
+		printf ("asmem: %s is already being recorded to\n", recFilename_G);
+		return false;
+	}
+	if (fstat (recFd_G, &st) == -1) {
+		perror ("fstat()");
+		return false;
+	}
+	if (st.st_size != 0 && st.st_size != (off_t)recMapSz_G) {
+		printf ("asmem: %s was recorded with another --record-size\n", recFilename_G);
+		return false;
+	}
+	if (st.st_size == 0 && ftruncate (recFd_G, (off_t)recMapSz_G) == -1) {
+		perror ("ftruncate()");
+		return false;
+	}
+	// faulted in now, rather than a page at a time while recording
+	rec_pG = (uint8_t*)mmap (NULL, recMapSz_G, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, recFd_G, 0);
+	if (rec_pG == MAP_FAILED) {
+		rec_pG = NULL;
+		perror ("mmap()");
+		return false;
+	}
+
+	recHeader_pG = (AsmemRecHeader_t*)rec_pG;
+	if (recHeader_pG->magic == 0) {
+		recHeader_pG->version = REC_VERSION;
+		recHeader_pG->blockSize = REC_BLOCKSZ;
+		recHeader_pG->blockCnt = blockCnt;
+		recHeader_pG->fieldCnt = MEMINFO_NKEYS;
+		recHeader_pG->interval = (uint32_t)updateInterval_G;
+		__atomic_store_n (&recHeader_pG->magic, REC_MAGIC, __ATOMIC_RELEASE);
+	}
+	else if (recHeader_pG->magic != REC_MAGIC || recHeader_pG->version != REC_VERSION || recHeader_pG->blockSize != REC_BLOCKSZ
+			|| recHeader_pG->blockCnt != blockCnt || recHeader_pG->fieldCnt != MEMINFO_NKEYS) {
+		printf ("asmem: %s wasn't recorded by this version of asmem\n", recFilename_G);
+		return false;
+	}
+	for (i=0; i<blockCnt; ++i) {
+		block_p = (const AsmemRecBlock_t*)(rec_pG + (size_t)(i + 1) * REC_BLOCKSZ);
+		if (block_p->seq > recSeq_G) {
+			recSeq_G = block_p->seq;
+			recBlock_G = i;
+		}
+	}
+	// the first sample starts a new block
+	recPos_G = REC_BLOCKSZ;
+
+	// signals are for the main thread
+	sigfillset (&all);
+	pthread_sigmask (SIG_SETMASK, &all, &old);
+	rtn = pthread_create (&recThread_G, NULL, rec_writer, NULL);
+	pthread_sigmask (SIG_SETMASK, &old, NULL);
+	if (rtn != 0) {
+		printf ("asmem: can't start a thread: %s\n", strerror (rtn));
+		return false;
+	}
+	recRunning_G = true;
+	VERBOSE ("recording to %s, %u blocks, the newest is %llu\n", recFilename_G, blockCnt, (unsigned long long)recSeq_G);
+	return true;
+}
+
+/* hands a sample to the recorder thread, without ever waiting for it */
+static void
+rec_push (const AsmemMeminfo_t *info_p)
+{
+	AsmemRecSample_t *sample_p;
+	struct timespec now;
+
+	clock_gettime (CLOCK_REALTIME, &now);
+	pthread_mutex_lock (&recLock_G);
+	if (recHead_G - recTail_G == REC_QUEUE)
+		++recDropped_G;
+	else {
+		sample_p = &recQueue_G[recHead_G++ % REC_QUEUE];
+		sample_p->time = (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / NSEC_PER_MSEC;
+		memcpy (&sample_p->info, info_p, sizeof (sample_p->info));
+		pthread_cond_signal (&recWake_G);
+	}
+	pthread_mutex_unlock (&recLock_G);
+}
+
+/* the recorder thread, it empties the queue before it quits */
+static void*
+rec_writer (void *arg_p)
+{
+	AsmemRecSample_t sample;
+
+	(void)arg_p;
+	pthread_mutex_lock (&recLock_G);
+	while (1) {
+		while (recHead_G == recTail_G && !recQuit_G)
+			pthread_cond_wait (&recWake_G, &recLock_G);
+		if (recHead_G == recTail_G)
+			break;
+		memcpy (&sample, &recQueue_G[recTail_G++ % REC_QUEUE], sizeof (sample));
+		pthread_mutex_unlock (&recLock_G);
+		rec_append (&sample);
+		pthread_mutex_lock (&recLock_G);
+	}
+	pthread_mutex_unlock (&recLock_G);
+	return NULL;
+}
+
+/*
+ * Encodes a record's payload at rec_p (REC_RECLEN bytes at most) against
+ * the previous record, or the block's time and zeros for the first one
+ * (see rec_new_block()). Returns its length.
+ */
+static size_t
+rec_encode (const AsmemRecSample_t *sample_p, bool first, uint8_t *rec_p)
+{
+	uint64_t val[MEMINFO_NKEYS], mask = 0;
+	uint8_t *p = rec_p;
+	int64_t late;
+	unsigned i;
+
+	late = (int64_t)(sample_p->time - recTime_G);
+	if (!first)
+		late -= recHeader_pG->interval;
+	p = rec_put_varint (p, REC_ZIGZAG (late));
+	for (i=0; i<MEMINFO_NKEYS; ++i) {
+		val[i] = *(const unsigned long*)((const char*)&sample_p->info + meminfoKeys_G[i].offset);
+		if (val[i] != recLast_G[i])
+			mask |= (uint64_t)1 << i;
+	}
+	p = rec_put_varint (p, mask);
+	for (i=0; i<MEMINFO_NKEYS; ++i)
+		if (mask & ((uint64_t)1 << i))
+			p = rec_put_varint (p, REC_ZIGZAG (val[i] - recLast_G[i]));
+	return (size_t)(p - rec_p);
+}
+
+/*
+ * Moves on to the next block of the ring, overwriting the oldest once it
+ * has gone round. It's marked unused while it's cleared, so that a crash
+ * half-way can't leave old records behind a new header.
+ */
+static void
+rec_new_block (uint64_t time)
+{
+	AsmemRecBlock_t *block_p;
+
+	if (recSeq_G != 0)
+		recBlock_G = (recBlock_G + 1) % recHeader_pG->blockCnt;
+	block_p = (AsmemRecBlock_t*)(rec_pG + (size_t)(recBlock_G + 1) * REC_BLOCKSZ);
+	__atomic_store_n (&block_p->seq, 0, __ATOMIC_RELEASE);
+	memset (block_p + 1, 0, REC_BLOCKSZ - sizeof (*block_p));
+	block_p->time = time;
+	__atomic_store_n (&block_p->seq, ++recSeq_G, __ATOMIC_RELEASE);
+
+	recPos_G = sizeof (*block_p);
+	recTime_G = time;
+	memset (recLast_G, 0, sizeof (recLast_G));
+}
+
+/* writes a record, into the next block if it doesn't fit into this one */
+static void
+rec_append (const AsmemRecSample_t *sample_p)
+{
+	uint8_t rec[1 + REC_MAXREC + 1];
+	uint8_t *block_p;
+	size_t len;
+	unsigned i;
+
+	len = rec_encode (sample_p, recPos_G == sizeof (AsmemRecBlock_t), rec + 1);
+	if (recPos_G + 1 + len + 1 > REC_BLOCKSZ) {
+		rec_new_block (sample_p->time);
+		len = rec_encode (sample_p, true, rec + 1);
+	}
+	rec[0] = (uint8_t)len;
+	rec[1 + len] = rec_check (rec, 1 + len);
+
+	// the length byte goes in last, it's what makes the record count
+	block_p = rec_pG + (size_t)(recBlock_G + 1) * REC_BLOCKSZ + recPos_G;
+	memcpy (block_p + 1, rec + 1, len + 1);
+	__atomic_store_n (block_p, rec[0], __ATOMIC_RELEASE);
+	recPos_G += 1 + len + 1;
+
+	recTime_G = sample_p->time;
+	for (i=0; i<MEMINFO_NKEYS; ++i)
+		recLast_G[i] = *(const unsigned long*)((const char*)&sample_p->info + meminfoKeys_G[i].offset);
+}
+
+/* for qsort(), on the keys rec_replay() makes of the blocks */
+static int
+rec_compare (const void *a_p, const void *b_p)
+{
+	uint64_t a = *(const uint64_t*)a_p;
+	uint64_t b = *(const uint64_t*)b_p;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Hands the records of a block to output_sample() (through trends_p, with
+ * --trend) and counts them in cnt_p. Returns false if it came across a torn one, where it stops.
+ */
+static bool
+rec_decode_block (const AsmemRecHeader_t *header_p, const uint8_t *block_p, AsmemTrends_t *trends_p, unsigned long *cnt_p)
+{
+	uint64_t last[REC_MAXFIELDS], time, mask, val;
+	AsmemMeminfo_t info;
+	const uint8_t *p, *end_p;
+	size_t pos, len;
+	unsigned i;
+
+	memset (last, 0, sizeof (last));
+	time = ((const AsmemRecBlock_t*)block_p)->time;
+	for (pos=sizeof (AsmemRecBlock_t); pos<header_p->blockSize && (len = block_p[pos]) != 0; pos+=1+len+1) {
+		if (pos + 1 + len + 1 > header_p->blockSize || rec_check (block_p + pos, 1 + len) != block_p[pos + 1 + len])
+			return false;
+		p = block_p + pos + 1;
+		end_p = p + len;
+		if (!rec_get_varint (&p, end_p, &val) || !rec_get_varint (&p, end_p, &mask))
+			return false;
+		if (header_p->fieldCnt < 64 && (mask >> header_p->fieldCnt) != 0)
+			return false;
+		time += REC_UNZIGZAG (val);
+		if (pos != sizeof (AsmemRecBlock_t))
+			time += header_p->interval;
+		for (i=0; i<header_p->fieldCnt; ++i) {
+			if ((mask & ((uint64_t)1 << i)) == 0)
+				continue;
+			if (!rec_get_varint (&p, end_p, &val))
+				return false;
+			last[i] += REC_UNZIGZAG (val);
+		}
+		if (p != end_p)
+			return false;
+
+		memset (&info, 0, sizeof (info));
+		for (i=0; i<header_p->fieldCnt && i<MEMINFO_NKEYS; ++i)
+			*(unsigned long*)((char*)&info + meminfoKeys_G[i].offset) = (unsigned long)last[i];
+		if (trend_G)
+			trend_update (trends_p, &info, time * NSEC_PER_MSEC);
+		output_sample (NULL, time * NSEC_PER_MSEC, &info, trends_p);
+		++*cnt_p;
+	}
+	return true;
+}
+
+/*
+ * --replay: writes out every sample of a --record file, oldest first, as
+ * --headless would have. The file may still be being recorded to.
+ */
+static bool
+rec_replay (void)
+{
+	const AsmemRecHeader_t *header_p;
+	const AsmemRecBlock_t *block_p;
+	const uint8_t *map_p;
+	uint64_t *order_p;
+	AsmemTrends_t trends;
+	unsigned long samples = 0;
+	unsigned i, cnt = 0, torn = 0;
+	struct stat st;
+	int fd;
+
+	if ((fd = open (replayFilename_G, O_RDONLY | O_CLOEXEC)) == -1) {
+		perror ("open()");
+		return false;
+	}
+	if (fstat (fd, &st) == -1 || st.st_size < (off_t)sizeof (AsmemRecHeader_t)) {
+		printf ("asmem: %s isn't a recording\n", replayFilename_G);
+		close (fd);
+		return false;
+	}
+	map_p = (const uint8_t*)mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close (fd);
+	if (map_p == MAP_FAILED) {
+		perror ("mmap()");
+		return false;
+	}
+	header_p = (const AsmemRecHeader_t*)map_p;
+	if (header_p->magic != REC_MAGIC || header_p->version != REC_VERSION || header_p->fieldCnt > REC_MAXFIELDS
+			|| header_p->blockSize < sizeof (AsmemRecHeader_t)
+			|| (uint64_t)(header_p->blockCnt + 1) * header_p->blockSize > (uint64_t)st.st_size) {
+		printf ("asmem: %s isn't a recording of this version of asmem\n", replayFilename_G);
+		munmap ((void*)map_p, (size_t)st.st_size);
+		return false;
+	}
+	if (!output_open ()) {
+		munmap ((void*)map_p, (size_t)st.st_size);
+		return false;
+	}
+
+	// oldest first: seq in the upper half of the key, the index in the lower
+	if ((order_p = (uint64_t*)malloc ((header_p->blockCnt + 1) * sizeof (uint64_t))) == NULL) {
+		perror ("malloc()");
+		munmap ((void*)map_p, (size_t)st.st_size);
+		return false;
+	}
+	for (i=0; i<header_p->blockCnt; ++i) {
+		block_p = (const AsmemRecBlock_t*)(map_p + (size_t)(i + 1) * header_p->blockSize);
+		if (block_p->seq != 0)
+			order_p[cnt++] = block_p->seq << 32 | i;
+	}
+	qsort (order_p, cnt, sizeof (uint64_t), rec_compare);
+	memset (&trends, 0, sizeof (trends));
+	for (i=0; i<cnt; ++i)
+		if (!rec_decode_block (header_p, map_p + (size_t)((order_p[i] & 0xffffffff) + 1) * header_p->blockSize, &trends, &samples))
+			++torn;
+	if (torn)
+		fprintf (stderr, "asmem: %s: %u blocks end in a torn record\n", replayFilename_G, torn);
+	VERBOSE ("%lu samples in %u blocks\n", samples, cnt);
+
+	free (order_p);
+	munmap ((void*)map_p, (size_t)st.st_size);
+	return true;
+}
+
+/* lets the recorder thread write out the queue before the file goes */
+static void
+rec_cleanup (void)
+{
+	if (recRunning_G) {
+		pthread_mutex_lock (&recLock_G);
+		recQuit_G = true;
+		pthread_cond_signal (&recWake_G);
+		pthread_mutex_unlock (&recLock_G);
+		pthread_join (recThread_G, NULL);
+		recRunning_G = false;
+	}
+	if (rec_pG != NULL) {
+		munmap (rec_pG, recMapSz_G);
+		rec_pG = NULL;
+		recHeader_pG = NULL;
+	}
+	if (recFd_G != -1) {
+		close (recFd_G);
+		recFd_G = -1;
+	}
+	if (recDropped_G)
+		VERBOSE ("%lu samples not recorded\n", recDropped_G);
+}
+
+/* ------------------------------------------------------------------------- */
+// self-instrumentation
+/* ------------------------------------------------------------------------- */
+static void
+stats_request (int sig)
+{
+	(void)sig;
+	statsRequested_G = 1;
+}
+
+/* adds a duration [ns] to a histogram */
+static void
+stats_record (AsmemHist_t *hist_p, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	unsigned bucket = 0;
+
+	while (us > 1 && bucket < STATS_BUCKETS - 1) {
+		us >>= 1;
+		++bucket;
+	}
+	++hist_p->bucket[bucket];
+	++hist_p->count;
+	hist_p->sum += ns;
+	if (ns > hist_p->max)
+		hist_p->max = ns;
+}
+
+/* how much the main thread has written so far [bytes], 0 if that isn't known */
+static unsigned long
+stats_written (void)
+{
+	char buf[256];
+	const char *p;
+	ssize_t len;
+
+	if (statsIoFd_G == -1 || (len = pread (statsIoFd_G, buf, sizeof (buf) - 1, 0)) <= 0)
+		return 0;
+	buf[len] = 0;
+	if ((p = strstr (buf, "wchar: ")) == NULL)
+		return 0;
+	return strtoul (p + 7, NULL, 10);
+}
+
+static void
+stats_dump_hist (const AsmemHist_t *hist_p)
+{
+	unsigned i;
+
+	fprintf (stderr, "%-16s %8lu", hist_p->name_p, (unsigned long)hist_p->count);
+	if (hist_p->count == 0) {
+		fprintf (stderr, "\n");
+		return;
+	}
+	fprintf (stderr, "  avg %lu us  max %lu us  |", (unsigned long)(hist_p->sum / hist_p->count / 1000), (unsigned long)(hist_p->max / 1000));
+	for (i=0; i<STATS_BUCKETS; ++i)
+		if (hist_p->bucket[i])
+			fprintf (stderr, " %s%luus:%lu", i == STATS_BUCKETS - 1 ? ">=" : "<", i == STATS_BUCKETS - 1 ? 1ul << i : 2ul << i, (unsigned long)hist_p->bucket[i]);
+	fprintf (stderr, "\n");
+}
+
+/* on SIGUSR1 and, with --stats, at exit */
+static void
+stats_dump (void)
+{
+	unsigned i;
+
+	fprintf (stderr, "asmem stats:\n");
+	fprintf (stderr, "samples %lu  redraws %lu  skipped redraws %lu  empty updates %lu  X events %lu\n",
+			statsSamples_G, statsRedraws_G, statsSkipped_G, statsEmpty_G, statsXEvents_G);
+	if (dpy_pG != NULL && statsFlush_G.count)
+		fprintf (stderr, "X requests %lu  X bytes %lu  per flush %lu requests %lu bytes\n", statsXRequests_G, statsXBytes_G,
+				statsXRequests_G / (unsigned long)statsFlush_G.count, statsXBytes_G / (unsigned long)statsFlush_G.count);
+	for (i=0; i<sizeof (statsHists_G) / sizeof (statsHists_G[0]); ++i)
+		stats_dump_hist (statsHists_G[i]);
+}
+
+/* ------------------------------------------------------------------------- */
+// scheduling
+/* ------------------------------------------------------------------------- */
+static uint64_t
+sched_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Whether samples are taken: while a window can be seen, and whatever
+ * the windows show while the --alert rules have to be checked, --record
+ * is keeping them or --metrics serves them. Windows which can't be seen
+ * aren't drawn.
+ */
+static bool
+sched_sampling (void)
+{
+	return visible_G || alertCnt_G || recRunning_G || metricsListenFd_G != -1;
+}
+
+/*
+ * The current sampling period [ns]: the (possibly adapted) interval,
+ * stretched while PSI says the system is calm.
+ */
+static uint64_t
+sched_period (void)
+{
+	int interval = schedInterval_G;
+
+	if (psiFdCnt_G && !psiHotTicks_G) {
+		if (interval < PSI_MAX_INTERVAL / PSI_BACKOFF)
+			interval *= PSI_BACKOFF;
+		else if (interval < PSI_MAX_INTERVAL)
+			interval = PSI_MAX_INTERVAL;
+	}
+	return (uint64_t)interval * NSEC_PER_MSEC;
+}
+
+/*
+ * Deadlines sit on a grid of the period (anchored at the monotonic clock's
+ * zero), so they don't accumulate drift, missed ticks are skipped rather
+ * than bunched up, and instances sharing a period wake together. The
+ * timer slack lets the kernel coalesce those wakeups even further.
+ */
+static uint64_t
+sched_next_deadline (uint64_t prev, uint64_t now)
+{
+	uint64_t period = sched_period ();
+	uint64_t next;
+
+	if (period / SLACK_DIV != schedSlack_G) {
+		schedSlack_G = period / SLACK_DIV;
+		if (prctl (PR_SET_TIMERSLACK, (unsigned long)schedSlack_G, 0, 0, 0) == -1)
+			perror ("prctl()");
+	}
+
+	next = (prev / period + 1) * period;
+	if (next <= now)
+		next = (now / period + 1) * period;
+	return next;
+}
+
+/* tighten the interval while values move quickly, relax while they're flat */
+static void
+sched_adapt (unsigned long delta)
+{
+	int minInterval = updateInterval_G / ADAPT_MIN_DIV;
+	int maxInterval = updateInterval_G * ADAPT_MAX_MUL;
+
+	// the first sample has nothing to compare with, its delta says nothing
+	if (!adaptive_G || delta == ULONG_MAX)
+		return;
+	if (minInterval < 1)
+		minInterval = 1;
+	if (maxInterval < updateInterval_G)
+		maxInterval = updateInterval_G;
+
+	if (delta >= mon_pG->fresh.memTotal * ADAPT_FAST_PCT / 100) {
+		schedInterval_G /= 2;
+		if (schedInterval_G < minInterval)
+			schedInterval_G = minInterval;
+	}
+	else if (delta == 0) {
+		schedInterval_G += schedInterval_G / 4 + 1;
+		if (schedInterval_G > maxInterval)
+			schedInterval_G = maxInterval;
+	}
+	VERBOSE ("delta:%lu interval:%d\n", delta, schedInterval_G);
+}
 
 /* ------------------------------------------------------------------------- */
-// x11
-/* ------------------------------------------------------------------------- */
+// memory pressure
+/* ------------------------------------------------------------------------- */
 /*
- * Note: this function was originally taken out of ascd.
- *
- * It takes the given colour, parses it in the context
- * of the given window and returns a pixel of that colour.
+ * Finds the cgroup v2 directory we're running in. Returns false if
+ * there isn't one, or if it's the root (whose pressure is the same as
+ * the system-wide one).
  */
-static Pixel
-x11_get_colour (char *colourName_p, Window win)
+static bool
+psi_get_cgroup (char *path_p, size_t len)
 {
-	XColor colour;
-	XWindowAttributes attr;
+	FILE *file_p;
+	char line[FNAMESZ];
+	size_t n;
+	bool found = false;
 
-	XGetWindowAttributes (dpy_pG, win, &attr);
-	colour.pixel = 0;
+	if ((file_p = fopen ("/proc/self/cgroup", "r")) == NULL)
+		return false;
 
-	if (!XParseColor (dpy_pG, attr.colormap, colourName_p, &colour))
-		printf ("asmem: can't parse %s\n", colourName_p);
-	else if (!XAllocColor (dpy_pG, attr.colormap, &colour))
-		printf ("asmem: can't allocate %s\n", colourName_p);
+	while (fgets (line, sizeof (line), file_p) != NULL) {
+		if (strncmp (line, "0::", 3) != 0)
+			continue;
+		n = strcspn (line + 3, "\n");
+		line[3 + n] = 0;
+		if (n > 1 && (size_t)snprintf (path_p, len, "%s%s/memory.pressure", CGROUP_ROOT, line + 3) < len)
+			found = true;
+		break;
+	}
 
-	return colour.pixel;
+	fclose (file_p);
+	return found;
 }
 
 /*
- * Performs the same actions as x11_get_colour() but
- * returns the complete XColor structure
+ * Registers a memory pressure trigger on the given PSI file. The returned
+ * fd signals POLLPRI whenever the stall threshold is crossed.
  */
-static XColor
-x11_parse_colour (char *colourName_p, Window win)
+static int
+psi_open_trigger (const char *path_p)
 {
-	XColor colour;
-	XWindowAttributes attr;
+	int fd;
 
-	XGetWindowAttributes (dpy_pG, win, &attr);
-	colour.pixel = 0;
+	if ((fd = open (path_p, O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1) {
+		VERBOSE ("can't open %s\n", path_p);
+		return -1;
+	}
+	if (write (fd, PSI_TRIGGER, strlen (PSI_TRIGGER) + 1) < 0) {
+		VERBOSE ("can't register trigger on %s\n", path_p);
+		close (fd);
+		return -1;
+	}
 
-	if (!XParseColor (dpy_pG, attr.colormap, colourName_p, &colour))
-		printf ("asmem: can't parse %s\n", colourName_p);
-	else if (!XAllocColor (dpy_pG, attr.colormap, &colour))
-		printf ("asmem: can't allocate %s\n", colourName_p);
+	VERBOSE ("psi trigger \"%s\" on %s\n", PSI_TRIGGER, path_p);
+	return fd;
+}
 
-	return colour;
+static void
+psi_initialize (void)
+{
+	int fd;
+	char cgroup[FNAMESZ];
+
+	if ((fd = psi_open_trigger (PSI_SYSTEM)) != -1)
+		psiFd_G[psiFdCnt_G++] = fd;
+	if (psi_get_cgroup (cgroup, sizeof (cgroup)) && (fd = psi_open_trigger (cgroup)) != -1)
+		psiFd_G[psiFdCnt_G++] = fd;
+
+	if (psiFdCnt_G == 0)
+		printf ("asmem: memory pressure information not available, using fixed interval\n");
 }
 
-/* darkens the given colour using the supplied rate */
-static char*
-x11_darken_char_colour (char *colourName_p, double rate, Window win)
+static void
+psi_cleanup (void)
+{
+	while (psiFdCnt_G)
+		close (psiFd_G[--psiFdCnt_G]);
+}
+
+/* ------------------------------------------------------------------------- */
+// x11
+/* ------------------------------------------------------------------------- */
+/*
+ * Parses a colour specification. "#rgb" style hex values are decoded
+ * right here; only colour names need a round trip to the server.
+ */
+static void
+x11_parse_colour (const char *colourName_p, XColor *colour_p)
 {
-	XColor tmpColour;
+	size_t len = strlen (colourName_p);
+	size_t digits, i;
+	unsigned short channel[3];
+	const char *p = colourName_p + 1;
+	int nibble;
+	bool valid = (colourName_p[0] == '#' && len > 1 && len <= 13 && (len - 1) % 3 == 0);
 
-	VERBOSE ("darkening %s ->", colourName_p);
-	tmpColour = x11_parse_colour (colourName_p, win);
-	VERBOSE (" #%x %x %x ", tmpColour.red, tmpColour.green, tmpColour.blue);
-	tmpColour.red = (unsigned short)((double)tmpColour.red / (double)257 / rate);
-	tmpColour.green = (unsigned short)((double)tmpColour.green / (double)257 / rate);
-	tmpColour.blue = (unsigned short)((double)tmpColour.blue / (double)257 / rate);
-	sprintf (tmpChar_G, "#%.2x%.2x%.2x", (int)tmpColour.red, (int)tmpColour.green, (int)tmpColour.blue);
-	VERBOSE ("-> %s\n", tmpChar_G);
+	memset (colour_p, 0, sizeof (*colour_p));
+	digits = (len - 1) / 3;
+	for (i=0; valid && i<3*digits; ++i, ++p) {
+		if (*p >= '0' && *p <= '9')
+			nibble = *p - '0';
+		else if (*p >= 'a' && *p <= 'f')
+			nibble = *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F')
+			nibble = *p - 'A' + 10;
+		else {
+			valid = false;
+			break;
+		}
+		channel[i / digits] = (unsigned short)((i % digits ? channel[i / digits] << 4 : 0) | nibble);
+	}
 
-	return tmpChar_G;
+	if (valid) {
+		// like XParseColor(), the given bits are the most significant ones
+		colour_p->red = (unsigned short)(channel[0] << (4 * (4 - digits)));
+		colour_p->green = (unsigned short)(channel[1] << (4 * (4 - digits)));
+		colour_p->blue = (unsigned short)(channel[2] << (4 * (4 - digits)));
+	}
+	else if (dpy_pG == NULL || !XParseColor (dpy_pG, colormap_G, colourName_p, colour_p))
+		printf ("asmem: can't parse %s\n", colourName_p);
+	colour_p->flags = DoRed | DoGreen | DoBlue;
 }
 
-/* darkens the given colour using the supplied rate */
-static Pixel
-x11_darken_colour (char *colourName_p, double rate, Window win)
+/*
+ * Darkens the given colour, rate is in tenths (i.e. 14 divides each
+ * channel by 1.4). The result is quantised to 8 bits per channel.
+ */
+static XColor
+x11_darken_colour (XColor colour, unsigned rate)
 {
-	return x11_get_colour (x11_darken_char_colour (colourName_p, rate, win), win);
+	colour.red = (unsigned short)((colour.red * 10u / (257u * rate)) << 8);
+	colour.green = (unsigned short)((colour.green * 10u / (257u * rate)) << 8);
+	colour.blue = (unsigned short)((colour.blue * 10u / (257u * rate)) << 8);
+	VERBOSE ("darkened by %u: #%04x%04x%04x\n", rate, colour.red, colour.green, colour.blue);
+	return colour;
 }
 
-/* lightens the given colour using the supplied rate */
-static char*
-x11_lighten_char_colour (char *colourName_p, double rate, Window win)
+/* lightens the given colour, rate is in tenths */
+static XColor
+x11_lighten_colour (XColor colour, unsigned rate)
 {
-	XColor tmpColour;
+	unsigned red = colour.red * rate / 2570u;
+	unsigned green = colour.green * rate / 2570u;
+	unsigned blue = colour.blue * rate / 2570u;
 
-	VERBOSE ("lightening %s ->", colourName_p);
-	tmpColour = x11_parse_colour (colourName_p, win);
-	VERBOSE (" #%x %x %x ", tmpColour.red, tmpColour.green, tmpColour.blue);
-	tmpColour.red = (unsigned short)((double)tmpColour.red / (double)257 * rate);
-	tmpColour.green = (unsigned short)((double)tmpColour.green / (double)257 * rate);
-	tmpColour.blue = (unsigned short)((double)tmpColour.blue / (double)257 * rate);
-	if (tmpColour.red > 255)
-		tmpColour.red = 255;
-	if (tmpColour.green > 255)
-		tmpColour.green = 255;
-	if (tmpColour.blue > 255)
-		tmpColour.blue = 255;
-	sprintf (tmpChar_G, "#%.2x%.2x%.2x", (int)tmpColour.red, (int)tmpColour.green, (int)tmpColour.blue);
-	VERBOSE ("-> %s\n", tmpChar_G);
+	colour.red = (unsigned short)((red > 255 ? 255 : red) << 8);
+	colour.green = (unsigned short)((green > 255 ? 255 : green) << 8);
+	colour.blue = (unsigned short)((blue > 255 ? 255 : blue) << 8);
+	VERBOSE ("lightened by %u: #%04x%04x%04x\n", rate, colour.red, colour.green, colour.blue);
+	return colour;
+}
+
+/* places the top bits of a 16 bit channel value into a visual's mask */
+static unsigned long
+x11_channel_bits (unsigned short value, unsigned long mask)
+{
+	int shift = __builtin_ctzl (mask);
+	int bits = __builtin_popcountl (mask);
 
-	return tmpChar_G;
+	if (bits > 16)
+		bits = 16;
+	return ((unsigned long)value >> (16 - bits)) << shift;
 }
 
-/* lightens the given colour using the supplied rate */
+/*
+ * Returns the pixel for a colour. On TrueColor visuals it is computed
+ * locally from the visual's masks; anything else has to ask the server.
+ */
 static Pixel
-x11_lighten_colour (char *colourName_p, double rate, Window win)
+x11_get_pixel (XColor *colour_p)
 {
-	return x11_get_colour (x11_lighten_char_colour (colourName_p, rate, win), win);
+	// no display: 32bit ARGB for the in-memory framebuffer
+	if (visual_pG == NULL) {
+		colour_p->pixel = 0xff000000ul | (unsigned long)(colour_p->red >> 8) << 16
+			| (unsigned long)(colour_p->green >> 8) << 8 | (unsigned long)(colour_p->blue >> 8);
+		return colour_p->pixel;
+	}
+	if (visual_pG->class == TrueColor) {
+		colour_p->pixel = x11_channel_bits (colour_p->red, visual_pG->red_mask)
+			| x11_channel_bits (colour_p->green, visual_pG->green_mask)
+			| x11_channel_bits (colour_p->blue, visual_pG->blue_mask);
+		return colour_p->pixel;
+	}
+
+	colour_p->pixel = 0;
+	if (!XAllocColor (dpy_pG, colormap_G, colour_p))
+		printf ("asmem: can't allocate #%04x%04x%04x\n", colour_p->red, colour_p->green, colour_p->blue);
+	return colour_p->pixel;
 }
 
-static void
-x11_draw_offscreen_win (void)
+/*
+ * Turns one of the indexed bitmaps from atlas.h into a pixmap scale_G
+ * times the size, using palette_p for its colours. The pixmap goes to
+ * the server with a single XPutImage.
+ */
+static bool
+x11_create_image (const unsigned char *bits_p, unsigned width, unsigned height, XColor *palette_p, AsmemImage_t *image_p)
 {
-	int points[3];
-	unsigned long val;
-	unsigned tmp[MAXDIGITS];
-	unsigned i, digitCnt;
-	int winWidth;
+	int screen;
+	unsigned depth;
+	XImage *ximage_p;
+	unsigned i, x, y, s = (unsigned)scale_G;
 
-	VERBOSE ("\n");
+	image_p->bits_p = bits_p;
+	image_p->width = width;
+	image_p->height = height;
+	for (i=0; i<4; ++i)
+		image_p->palette[i] = x11_get_pixel (&palette_p[i]);
 
-	// figure out the window width (based on xpm size)
-	winWidth = (int)backgroundXpm_G.attributes.width - WIDTH_PADDING;
+	// the in-memory framebuffer only needs the colours
+	if (dpy_pG == NULL)
+		return true;
+	screen = DefaultScreen (dpy_pG);
+	depth = (unsigned)DefaultDepth (dpy_pG, screen);
+
+	ximage_p = XCreateImage (dpy_pG, visual_pG, depth, ZPixmap, 0, NULL, width * s, height * s, 32, 0);
+	if (ximage_p == NULL)
+		return false;
+	ximage_p->data = (char*)malloc ((size_t)ximage_p->bytes_per_line * height * s);
+	if (ximage_p->data == NULL) {
+		XDestroyImage (ximage_p);
+		return false;
+	}
+	for (y=0; y<height*s; ++y)
+		for (x=0; x<width*s; ++x)
+			XPutPixel (ximage_p, (int)x, (int)y, image_p->palette[ATLAS_INDEX (bits_p, width, x / s, y / s)]);
 
-	// paint background
-	XCopyArea (dpy_pG, backgroundXpm_G.pixmap, drawWin_G, mainGC_G, 0, 0, backgroundXpm_G.attributes.width, backgroundXpm_G.attributes.height, 0, 0);
+	image_p->pixmap = XCreatePixmap (dpy_pG, rootWin_G, width * s, height * s, depth);
+	XPutImage (dpy_pG, image_p->pixmap, DefaultGC (dpy_pG, screen), ximage_p, 0, 0, 0, 0, width * s, height * s);
+	XDestroyImage (ximage_p);
+	return true;
+}
 
-	// string of total memory
-	val = fresh_G.memTotal;
-	digitCnt = 0;
-	for (i=0; i<MAXDIGITS; ++i) {
-		tmp[i] = (unsigned)(val % 10);
-		val /= 10;
-		++digitCnt;
-		if (val == 0)
-			break;
+/* grows the area to be copied to the windows by the given rectangle */
+static void
+x11_mark_dirty (int x, int y, int w, int h)
+{
+	if (mon_pG->dirtyX1 <= mon_pG->dirtyX0 || mon_pG->dirtyY1 <= mon_pG->dirtyY0) {
+		mon_pG->dirtyX0 = x;
+		mon_pG->dirtyY0 = y;
+		mon_pG->dirtyX1 = x + w;
+		mon_pG->dirtyY1 = y + h;
+		return;
 	}
-	for (i=0; i<digitCnt; ++i)
-		XCopyArea (dpy_pG, alphabetXpm_G.pixmap, drawWin_G, mainGC_G, (int)(tmp[i] * 5), 0, 6, 9, (int)(winWidth - ((int)i * 5)), 2);
+	if (x < mon_pG->dirtyX0)
+		mon_pG->dirtyX0 = x;
+	if (y < mon_pG->dirtyY0)
+		mon_pG->dirtyY0 = y;
+	if (x + w > mon_pG->dirtyX1)
+		mon_pG->dirtyX1 = x + w;
+	if (y + h > mon_pG->dirtyY1)
+		mon_pG->dirtyY1 = y + h;
+}
+
+/*
+ * Turns val into glyph cells. With msdFirst the most significant digit
+ * goes into the first cell (left-aligned fields), otherwise the least
+ * significant one does (right-aligned fields). Unused cells are blank.
+ */
+static void
+x11_format_number (unsigned long val, signed char *cell_p, unsigned cells, bool msdFirst)
+{
+	signed char tmp[MAXDIGITS];
+	unsigned i, digitCnt = 0;
 
-	// string of memory used
-	val = fresh_G.memTotal - fresh_G.memFree;
-	digitCnt = 0;
-	for (i=0; i<MAXDIGITS; ++i) {
-		tmp[i] = (unsigned)(val % 10);
+	for (i=0; i<cells; ++i) {
+		tmp[i] = (signed char)(val % 10);
 		val /= 10;
 		++digitCnt;
 		if (val == 0)
 			break;
 	}
-	for (i=0; i<digitCnt; ++i)
-		XCopyArea (dpy_pG, alphabetXpm_G.pixmap, drawWin_G, mainGC_G, (int)(tmp[(int)digitCnt-1-(int)i] * 5), 0, 6, 9, 2 + ((int)i * 5), 17);
+	for (i=0; i<cells; ++i) {
+		if (i >= digitCnt)
+			cell_p[i] = GLYPH_BLANK;
+		else
+			cell_p[i] = msdFirst ? tmp[digitCnt-1-i] : tmp[i];
+	}
+}
 
-	// string of percentage memory used
-	val = (unsigned long)((((double)fresh_G.memTotal) - ((double)fresh_G.memFree)) / ((double)fresh_G.memTotal) * (double)100);
-	if (val >= 100)
-		tmp[0] = (unsigned)(val / 100);
-	else
-		tmp[0] = 13;
-	if (val >= 10)
-		tmp[1] = (unsigned)(val % 100 / 10);
-	else
-		tmp[1] = 10;
-	tmp[2] = (unsigned)(val % 100 % 10);
-	tmp[3] = 11;
-	for (i=0; i<4; ++i)
-		XCopyArea (dpy_pG, alphabetXpm_G.pixmap, drawWin_G, mainGC_G, (int)(tmp[i] * 5), 0, 6, 9, 32 + ((int)i * 5), 17);
+static void
+x11_format_percent (unsigned long used, unsigned long total, signed char *cell_p)
+{
+	unsigned long val = 0;
 
-	// draw the memory bar
-	points[0] = (int)(((((double)fresh_G.memTotal - ((double)fresh_G.memFree)) - (double)fresh_G.memBuffers - (double)fresh_G.memCached)) / ((double)fresh_G.memTotal) * (double)winWidth);
-	points[1] = (int)(((double)fresh_G.memBuffers) / ((double)fresh_G.memTotal) * ((double)winWidth));
-	points[2] = (int)(((double)fresh_G.memCached) / ((double)fresh_G.memTotal) * ((double)winWidth));
-	for (i=0; i<3; ++i) {
-		mainGCV_G.foreground = pix_G[cMEM][i];
-		XChangeGC (dpy_pG, mainGC_G, GCForeground, &mainGCV_G);
-		XFillRectangle (dpy_pG, drawWin_G, mainGC_G, 3, (int)(13 + i), (unsigned)points[0], 1);
+	if (total)
+		val = (unsigned long)((double)used / (double)total * (double)100);
+
+	cell_p[0] = val >= 100 ? (signed char)(val / 100 % 10) : GLYPH_SPACE;
+	cell_p[1] = val >= 10 ? (signed char)(val % 100 / 10) : GLYPH_DIMZERO;
+	cell_p[2] = (signed char)(val % 10);
+	cell_p[3] = GLYPH_PERCENT;
+}
+
+static unsigned
+x11_bar_width (unsigned long val, unsigned long total)
+{
+	int winWidth = (int)background_G.width - WIDTH_PADDING;
+
+	if (total == 0)
+		return 0;
+	return (unsigned)((double)val / (double)total * (double)winWidth);
+}
+
+/* works out what the window should look like for the latest sample */
+static void
+x11_compose_frame (AsmemFrame_t *frame_p)
+{
+	unsigned long memUsed = meminfo_used (&mon_pG->fresh);
+	unsigned long swapUsed = mon_pG->fresh.swapTotal - mon_pG->fresh.swapFree;
+	unsigned long seg[3];
+	unsigned i, j;
+
+	memset (frame_p, 0, sizeof (*frame_p));
+
+	x11_format_number (mon_pG->fresh.memTotal, frame_p->glyph[tMEMTOTAL], textFields_G[tMEMTOTAL].cells, false);
+	x11_format_number (memUsed, frame_p->glyph[tMEMUSED], textFields_G[tMEMUSED].cells, true);
+	x11_format_percent (memUsed, mon_pG->fresh.memTotal, frame_p->glyph[tMEMPCT]);
+	x11_format_number (mon_pG->fresh.swapTotal, frame_p->glyph[tSWPTOTAL], textFields_G[tSWPTOTAL].cells, false);
+	x11_format_number (swapUsed, frame_p->glyph[tSWPUSED], textFields_G[tSWPUSED].cells, true);
+	x11_format_percent (swapUsed, mon_pG->fresh.swapTotal, frame_p->glyph[tSWPPCT]);
+
+	// the top processes' PIDs and shares of memory, blanks cover up the background
+	if (top_G)
+		for (i=0; i<TOP_ROWS; ++i) {
+			if (i < topCnt_G) {
+				x11_format_number ((unsigned long)topList_G[i].pid, frame_p->glyph[tTOPPID+i], USED_CELLS, true);
+				x11_format_percent (topList_G[i].rss * (unsigned long)topPageKb_G, mon_pG->fresh.memTotal * 1000, frame_p->glyph[tTOPPCT+i]);
+			}
+			else {
+				memset (frame_p->glyph[tTOPPID+i], GLYPH_BLANK, USED_CELLS);
+				memset (frame_p->glyph[tTOPPCT+i], GLYPH_BLANK, PCT_CELLS);
+			}
+			for (j=0; j<USED_CELLS; ++j)
+				if (frame_p->glyph[tTOPPID+i][j] == GLYPH_BLANK)
+					frame_p->glyph[tTOPPID+i][j] = GLYPH_SPACE;
+			for (j=0; j<PCT_CELLS; ++j)
+				if (frame_p->glyph[tTOPPCT+i][j] == GLYPH_BLANK)
+					frame_p->glyph[tTOPPCT+i][j] = GLYPH_SPACE;
+		}
+
+	meminfo_segments (&mon_pG->fresh, seg);
+	for (i=0; i<3; ++i)
+		frame_p->memBar[i] = x11_bar_width (seg[i], mon_pG->fresh.memTotal);
+	frame_p->swapBar[0] = x11_bar_width (swapUsed, mon_pG->fresh.swapTotal);
+
+	// --swaps: disk, then compressed RAM, and how much RAM the compressed swap takes
+	if (swaps_G) {
+		seg[0] = swapsSlow_G < mon_pG->fresh.swapTotal ? swapsSlow_G : mon_pG->fresh.swapTotal;
+		seg[1] = swapsFast_G < mon_pG->fresh.swapTotal - seg[0] ? swapsFast_G : mon_pG->fresh.swapTotal - seg[0];
+		frame_p->swapBar[0] = x11_bar_width (seg[0], mon_pG->fresh.swapTotal);
+		frame_p->swapBar[1] = x11_bar_width (seg[1], mon_pG->fresh.swapTotal);
+		x11_format_percent (swapsCompr_G, swapsOrig_G, frame_p->glyph[tSWPPCT]);
 	}
-	for (i=0; i<3; ++i) {
-		mainGCV_G.foreground = pix_G[cBUF][i];
-		XChangeGC (dpy_pG, mainGC_G, GCForeground, &mainGCV_G);
-		XFillRectangle (dpy_pG, drawWin_G, mainGC_G, 3 + points[0], (int)(13 + i), (unsigned)points[1], 1);
+
+	// --trend: the peaks of the last TREND_BUCKETS spans, and minutes left instead of the swap total
+	if (trend_G) {
+		trend_range (&mon_pG->trends, trRAM, &seg[0], &seg[1]);
+		frame_p->memPeak = x11_bar_width (seg[1], mon_pG->fresh.memTotal);
+		trend_range (&mon_pG->trends, trSWAP, &seg[0], &seg[1]);
+		frame_p->swapPeak = x11_bar_width (seg[1], mon_pG->fresh.swapTotal);
+		if (mon_pG->trends.eta >= 0 && mon_pG->trends.eta < TREND_HORIZON * 60) {
+			x11_format_number ((unsigned long)mon_pG->trends.eta / 60, frame_p->glyph[tSWPTOTAL], textFields_G[tSWPTOTAL].cells, false);
+			for (i=0; i<textFields_G[tSWPTOTAL].cells; ++i)
+				if (frame_p->glyph[tSWPTOTAL][i] != GLYPH_BLANK)
+					frame_p->glyph[tSWPTOTAL][i] += GLYPH_ETA;
+		}
 	}
-	for (i=0; i<3; ++i) {
-		mainGCV_G.foreground = pix_G[cCHE][i];
-		XChangeGC (dpy_pG, mainGC_G, GCForeground, &mainGCV_G);
-		XFillRectangle (dpy_pG, drawWin_G, mainGC_G, 3 + points[0] + (int)points[1], (int)(13 + i), (unsigned)points[2], 1);
+}
+
+/* draws the cells of a text field which differ from what's on screen */
+static void
+x11_draw_text (unsigned field, const signed char *cell_p)
+{
+	const TextField_t *field_p = &textFields_G[field];
+	unsigned i;
+	int x;
+
+	for (i=0; i<field_p->cells; ++i) {
+		if (cell_p[i] == mon_pG->drawn.glyph[field][i])
+			continue;
+
+		x = field_p->x + (int)i * field_p->step;
+		if (cell_p[i] == GLYPH_BLANK)
+			backend_pG->blitBackground_p (x, field_p->y, GLYPH_W, GLYPH_H);
+		else
+			backend_pG->blitGlyph_p (cell_p[i], x, field_p->y);
+		x11_mark_dirty (x, field_p->y, GLYPH_W, GLYPH_H);
 	}
+}
 
-	// string of swap total
-	val = fresh_G.swapTotal;
-	digitCnt = 0;
-	for (i=0; i<MAXDIGITS; ++i) {
-		tmp[i] = (unsigned)val % 10;
-		val /= 10;
-		++digitCnt;
-		if (val == 0)
-			break;
+/*
+ * Redraws the span of a bar where the old and new segments disagree:
+ * the background is restored under it and each segment's share of it is
+ * copied out of the bar strips.
+ */
+static void
+x11_draw_bar (int y, const unsigned *colour_p, const unsigned *old_p, const unsigned *new_p, unsigned segments)
+{
+	unsigned i;
+	int from = 0, to, oldEnd = 0, newEnd = 0, pos, start, end;
+
+	for (i=0; i<segments; ++i) {
+		oldEnd += (int)old_p[i];
+		newEnd += (int)new_p[i];
 	}
-	for (i=0; i<digitCnt; ++i)
-		XCopyArea (dpy_pG, alphabetXpm_G.pixmap, drawWin_G, mainGC_G, (int)tmp[i] * 5, 0, 6, 9, (int)(winWidth - ((int)i * 5)), 27);
 
-	// string of swap used
-	val = fresh_G.swapTotal - fresh_G.swapFree;
-	digitCnt = 0;
-	for (i=0; i<MAXDIGITS; ++i) {
-		tmp[i] = (unsigned)val % 10;
-		val /= 10;
-		++digitCnt;
-		if (val == 0)
-			break;
+	// everything up to the first segment which changed stays put
+	for (i=0; i<segments && old_p[i] == new_p[i]; ++i)
+		from += (int)new_p[i];
+	if (i == segments)
+		return;
+	from += (int)(old_p[i] < new_p[i] ? old_p[i] : new_p[i]);
+	to = oldEnd > newEnd ? oldEnd : newEnd;
+	if (to <= from)
+		return;
+
+	backend_pG->blitBackground_p (BAR_X + from, y, to - from, BAR_ROWS);
+
+	for (i=0, pos=0; i<segments; pos+=(int)new_p[i], ++i) {
+		start = pos > from ? pos : from;
+		end = pos + (int)new_p[i] < to ? pos + (int)new_p[i] : to;
+		if (end > start)
+			backend_pG->blitBar_p (colour_p[i], BAR_X + start, y, end - start);
 	}
-	for (i=0; i<digitCnt; ++i)
-		XCopyArea (dpy_pG, alphabetXpm_G.pixmap, drawWin_G, mainGC_G, (int)(tmp[digitCnt-1-i] * 5), 0, 6, 9, (int)(2 + (i * 5)), 42);
+	x11_mark_dirty (BAR_X + from, y, to - from, BAR_ROWS);
+}
 
-	// string of percentage swap used
-	val = (unsigned long)((((double)fresh_G.swapTotal) - ((double)fresh_G.swapFree)) / ((double)fresh_G.swapTotal) * ((double)100));
-	if (val >= 100)
-		tmp[0] = (unsigned)val / 100;
-	else
-		tmp[0] = 13;
-	if (val >= 10)
-		tmp[1] = (unsigned)val % 100 / 10;
-	else
-		tmp[1] = 10;
-	tmp[2] = (unsigned)val % 100 % 10;
-	tmp[3] = 11;
-	for (i=0; i<4; ++i)
-		XCopyArea (dpy_pG, alphabetXpm_G.pixmap, drawWin_G, mainGC_G, (int)(tmp[i] * 5), 0, 6, 9, (int)(32 + (i * 5)), 42);
+/*
+ * Moves a bar's --trend peak marker (a column in the foreground colour,
+ * 1 + its x, 0 for none): where it was gets the bar's own pixels back.
+ * It's drawn again after the bar, which may have drawn over it.
+ */
+static void
+x11_draw_peak (int y, const unsigned *colour_p, const unsigned *bar_p, unsigned segments, unsigned oldPeak, unsigned newPeak)
+{
+	unsigned i, pos;
+	int x;
 
-	// draw swap bar
-	points[0] = (int)((((double)fresh_G.swapTotal) - ((double)fresh_G.swapFree)) / ((double)fresh_G.swapTotal) * ((double)winWidth));
-	for (i=0; i<3; ++i) {
-		mainGCV_G.foreground = pix_G[cSWP][i];
-		XChangeGC (dpy_pG, mainGC_G, GCForeground, &mainGCV_G);
-		XFillRectangle (dpy_pG, drawWin_G, mainGC_G, 3, (int)(38 + i), (unsigned)points[0], 1);
+	if (oldPeak != 0 && oldPeak != newPeak) {
+		x = BAR_X + (int)oldPeak - 1;
+		backend_pG->blitBackground_p (x, y, 1, BAR_ROWS);
+		for (i=0, pos=0; i<segments; pos+=bar_p[i], ++i)
+			if (oldPeak > pos && oldPeak <= pos + bar_p[i]) {
+				backend_pG->blitBar_p (colour_p[i], x, y, 1);
+				break;
+			}
+		x11_mark_dirty (x, y, 1, BAR_ROWS);
+	}
+	if (newPeak != 0) {
+		x = BAR_X + (int)newPeak - 1;
+		backend_pG->blitFill_p (fgPix_G, x, y, 1, BAR_ROWS);
+		x11_mark_dirty (x, y, 1, BAR_ROWS);
+	}
+}
+
+/*
+ * Renders one strip per bar colour (light/regular/dark rows) so that
+ * drawing a bar segment doesn't need any GC changes.
+ */
+static void
+x11_create_bar_strips (void)
+{
+	unsigned colour, hue, s = (unsigned)scale_G;
+	unsigned winWidth = (background_G.width - WIDTH_PADDING) * s;
+
+	barsPix_G = XCreatePixmap (dpy_pG, rootWin_G, winWidth, 4 * BAR_ROWS * s, (unsigned)DefaultDepth (dpy_pG, DefaultScreen (dpy_pG)));
+	for (colour=0; colour<4; ++colour)
+		for (hue=0; hue<BAR_ROWS; ++hue) {
+			XSetForeground (dpy_pG, mainGC_G, pix_G[colour][hue]);
+			XFillRectangle (dpy_pG, barsPix_G, mainGC_G, 0, (int)((colour * BAR_ROWS + hue) * s), winWidth, s);
+		}
+}
+
+/* the xlib backend's drawing primitives, into drawWin on the server, scaled */
+static void
+x11_blit_background (int x, int y, int w, int h)
+{
+	int s = scale_G;
+
+	XCopyArea (dpy_pG, background_G.pixmap, mon_pG->drawWin, mainGC_G, x * s, y * s, (unsigned)(w * s), (unsigned)(h * s), x * s, y * s);
+}
+
+static void
+x11_blit_glyph (int glyph, int x, int y)
+{
+	Pixmap pixmap = glyph >= GLYPH_ETA ? etaAlphabet_G.pixmap : alphabet_G.pixmap;
+	int s = scale_G;
+
+	XCopyArea (dpy_pG, pixmap, mon_pG->drawWin, mainGC_G, glyph % GLYPH_ETA * GLYPH_STEP * s, 0, (unsigned)(GLYPH_W * s), (unsigned)(GLYPH_H * s), x * s, y * s);
+}
+
+static void
+x11_blit_bar (unsigned colour, int x, int y, int w)
+{
+	int s = scale_G;
+
+	XCopyArea (dpy_pG, barsPix_G, mon_pG->drawWin, mainGC_G, (x - BAR_X) * s, (int)colour * BAR_ROWS * s, (unsigned)(w * s), (unsigned)(BAR_ROWS * s), x * s, y * s);
+}
+
+static void
+x11_blit_fill (Pixel pixel, int x, int y, int w, int h)
+{
+	int s = scale_G;
+
+	if (w <= 0 || h <= 0)
+		return;
+	XSetForeground (dpy_pG, mainGC_G, pixel);
+	XFillRectangle (dpy_pG, mon_pG->drawWin, mainGC_G, x * s, y * s, (unsigned)(w * s), (unsigned)(h * s));
+}
+
+/* moves the contents of the given area one column to the left */
+static void
+x11_blit_scroll (int x, int y, int w, int h)
+{
+	int s = scale_G;
+
+	XCopyArea (dpy_pG, mon_pG->drawWin, mon_pG->drawWin, mainGC_G, (x + 1) * s, y * s, (unsigned)((w - 1) * s), (unsigned)(h * s), x * s, y * s);
+}
+
+/* copies part of drawWin to whichever of the monitor's windows are mapped */
+static void
+x11_present (int x, int y, unsigned w, unsigned h)
+{
+	// an unmapped window gets all of it on its next Expose
+	if (!mon_pG->mainMapped && !mon_pG->iconMapped)
+		return;
+	if (mon_pG->mainMapped)
+		XCopyArea (dpy_pG, mon_pG->drawWin, mon_pG->mainWin, mainGC_G, x, y, w, h, x, y);
+	if (mon_pG->iconMapped)
+		XCopyArea (dpy_pG, mon_pG->drawWin, mon_pG->iconWin, mainGC_G, x, y, w, h, x, y);
+	XFlush (dpy_pG);
+}
+
+/*
+ * A column of the history graph or a node's tile of the panel: used,
+ * buffers, cache and used swap stacked from the bottom, scaled to the
+ * total of memory and swap.
+ */
+static void
+x11_draw_usage (int x, int top, int w, int h, const AsmemMeminfo_t *info_p)
+{
+	unsigned long val[4], total;
+	int i, y = top + h, graphH = h;
+
+	backend_pG->blitFill_p (bgPix_G, x, top, w, h);
+	if (info_p == NULL)
+		return;
+
+	total = info_p->memTotal + info_p->swapTotal;
+	if (total == 0)
+		return;
+	meminfo_segments (info_p, val);
+	val[cSWP] = info_p->swapTotal - info_p->swapFree;
+
+	for (i=0; i<4; ++i) {
+		h = (int)((double)val[i] / (double)total * (double)graphH);
+		if (h > y - top)
+			h = y - top;
+		y -= h;
+		backend_pG->blitFill_p (pix_G[i][cREG], x, y, w, h);
+	}
+}
+
+/*
+ * Either paints the whole graph from the history ring, or scrolls what's
+ * there by a column and paints just the newest sample.
+ */
+static void
+x11_draw_history (bool full)
+{
+	int col;
+
+	if (full)
+		for (col=0; col<graphW_G; ++col)
+			x11_draw_usage (GRAPH_X + col, GRAPH_Y, 1, graphH_G, history_get ((unsigned)(graphW_G - 1 - col)));
+	else {
+		backend_pG->blitScroll_p (GRAPH_X, GRAPH_Y, graphW_G, graphH_G);
+		x11_draw_usage (GRAPH_X + graphW_G - 1, GRAPH_Y, 1, graphH_G, history_get (0));
+	}
+	x11_mark_dirty (GRAPH_X, GRAPH_Y, graphW_G, graphH_G);
+}
+
+/*
+ * The --view panel, in the graph's place: a grid of tiles, the local
+ * machine first, then the nodes in the order they were given. A node
+ * without a sample (not connected) shows just a line along the bottom.
+ * Only the tiles with news are redrawn unless it's a full redraw.
+ */
+static void
+x11_draw_panel (bool full)
+{
+	AsmemNode_t *node_p;
+	unsigned i;
+	int x, y, w, h;
+
+	w = tileW_G > 1 ? tileW_G - 1 : 1;
+	h = tileH_G > 1 ? tileH_G - 1 : 1;
+	for (i=0; i<=netNodeCnt_G; ++i) {
+		x = GRAPH_X + (int)i % panelCols_G * tileW_G;
+		y = GRAPH_Y + (int)i / panelCols_G * tileH_G;
+		if (i == 0)
+			x11_draw_usage (x, y, w, h, &mon_pG->fresh);
+		else {
+			node_p = &netNodes_pG[i-1];
+			if (!full && !node_p->dirty)
+				continue;
+			node_p->dirty = false;
+			x11_draw_usage (x, y, w, h, node_p->valid ? &node_p->info : NULL);
+			if (!node_p->valid)
+				backend_pG->blitFill_p (fgPix_G, x, y + h - 1, w, 1);
+		}
+		x11_mark_dirty (x, y, w, h);
+	}
+}
+
+/*
+ * The --numa view: a column per node, stacked like the history graph but
+ * scaled to the node's own memory, and the remote allocation bar along
+ * the bottom. Columns are only redrawn when their node changed.
+ */
+static void
+x11_draw_numa (bool full)
+{
+	static const unsigned remoteColours[1] = {cSWP};
+	AsmemNumaNode_t *node_p;
+	unsigned i, bar;
+	int x, w, h = graphH_G - BAR_ROWS - 2;
+
+	if (full)
+		backend_pG->blitFill_p (bgPix_G, GRAPH_X, GRAPH_Y, graphW_G, graphH_G - BAR_ROWS);
+
+	w = graphW_G / (int)numaNodeCnt_G;
+	for (i=0; i<numaNodeCnt_G; ++i) {
+		node_p = &numaNodes_G[i];
+		if (!full && memcmp (&node_p->drawn, &node_p->info, sizeof (node_p->info)) == 0)
+			continue;
+		memcpy (&node_p->drawn, &node_p->info, sizeof (node_p->info));
+		x = GRAPH_X + (int)i * w;
+		x11_draw_usage (x, GRAPH_Y, w > 1 ? w - 1 : 1, h, &node_p->info);
+		x11_mark_dirty (x, GRAPH_Y, w, h);
+	}
+
+	if (full)
+		numaRemoteBar_G = 0;
+	bar = x11_bar_width (numaRemotePct_G, 100);
+	x11_draw_bar (GRAPH_Y + graphH_G - BAR_ROWS, remoteColours, &numaRemoteBar_G, &bar, 1);
+	numaRemoteBar_G = bar;
+}
+
+/* brings the monitor's frame up to date with its latest sample, touching only what changed */
+static void
+x11_draw_offscreen_win (void)
+{
+	static const unsigned memColours[3] = {cMEM, cBUF, cCHE};
+	static const unsigned swapColours[2] = {cSWP, cCHE};
+	AsmemFrame_t frame;
+	unsigned i;
+	bool full = !mon_pG->drawnValid;
+
+	VERBOSE ("\n");
+
+	x11_compose_frame (&frame);
+	if (!mon_pG->drawnValid) {
+		backend_pG->blitBackground_p (0, 0, (int)background_G.width, (int)background_G.height);
+		x11_mark_dirty (0, 0, (int)background_G.width, (int)background_G.height);
+		// a blank window: no glyphs, zero length bars
+		memset (&mon_pG->drawn, 0, sizeof (mon_pG->drawn));
+		memset (mon_pG->drawn.glyph, GLYPH_BLANK, sizeof (mon_pG->drawn.glyph));
+		mon_pG->drawnValid = true;
+		mon_pG->alertLit = false;
+		// the bars are stacked without their frames above the process list, whose right edge is a column further
+		if (top_G)
+			backend_pG->blitFill_p (bgPix_G, GRAPH_X, GRAPH_Y, graphW_G + 1, graphH_G);
+	}
+
+	for (i=0; i<tCOUNT; ++i)
+		x11_draw_text (i, frame.glyph[i]);
+	if (netNodeCnt_G)
+		x11_draw_panel (full);
+	else if (numa_G)
+		x11_draw_numa (full);
+	else if (history_G)
+		x11_draw_history (full);
+	else {
+		x11_draw_bar (MEMBAR_Y, memColours, mon_pG->drawn.memBar, frame.memBar, 3);
+		x11_draw_bar (swpBarY_G, swapColours, mon_pG->drawn.swapBar, frame.swapBar, 2);
+		if (frame.memPeak != mon_pG->drawn.memPeak || memcmp (frame.memBar, mon_pG->drawn.memBar, sizeof (frame.memBar)) != 0)
+			x11_draw_peak (MEMBAR_Y, memColours, frame.memBar, 3, mon_pG->drawn.memPeak, frame.memPeak);
+		if (frame.swapPeak != mon_pG->drawn.swapPeak || memcmp (frame.swapBar, mon_pG->drawn.swapBar, sizeof (frame.swapBar)) != 0)
+			x11_draw_peak (swpBarY_G, swapColours, frame.swapBar, 2, mon_pG->drawn.swapPeak, frame.swapPeak);
+	}
+	if (mon_pG->alertOn || mon_pG->alertLit)
+		x11_draw_alert ();
+
+	memcpy (&mon_pG->drawn, &frame, sizeof (mon_pG->drawn));
+}
+
+/* flashes a border around the window, a frame on, a frame off, while an alert is on */
+static void
+x11_draw_alert (void)
+{
+	int w = (int)background_G.width;
+	int h = (int)background_G.height;
+	Pixel pixel = pix_G[cSWP][cREG];
+
+	mon_pG->alertLit = mon_pG->alertOn && !mon_pG->alertLit;
+	if (mon_pG->alertLit) {
+		backend_pG->blitFill_p (pixel, 0, 0, w, 1);
+		backend_pG->blitFill_p (pixel, 0, h - 1, w, 1);
+		backend_pG->blitFill_p (pixel, 0, 1, 1, h - 2);
+		backend_pG->blitFill_p (pixel, w - 1, 1, 1, h - 2);
 	}
+	else {
+		backend_pG->blitBackground_p (0, 0, w, 1);
+		backend_pG->blitBackground_p (0, h - 1, w, 1);
+		backend_pG->blitBackground_p (0, 1, 1, h - 2);
+		backend_pG->blitBackground_p (w - 1, 1, 1, h - 2);
+	}
+	x11_mark_dirty (0, 0, w, h);
+}
+
+/* sets or clears the urgency hint, which most window managers flash or raise */
+static void
+x11_set_urgency (bool urgent)
+{
+	XWMHints WmHints;
+
+	WmHints.flags = IconWindowHint | (urgent ? XUrgencyHint : 0);
+	WmHints.icon_window = mon_pG->iconWin;
+	XSetWMHints (dpy_pG, mon_pG->mainWin, &WmHints);
+	XFlush (dpy_pG);
 }
 
 static void
 x11_check_events (void)
 {
 	XEvent event;
+	unsigned i;
 
 	VERBOSE ("\n");
 
 	while (XPending (dpy_pG)) {
 		XNextEvent (dpy_pG, &event);
+		++statsXEvents_G;
+		if (!monitor_select (event.xany.window))
+			mon_pG = &monitors_G[0];
 		switch (event.type) {
 			case Expose:
+				// back into unscaled pixels, rounding outwards
+				x11_mark_dirty (event.xexpose.x / scale_G, event.xexpose.y / scale_G,
+						(event.xexpose.x + event.xexpose.width + scale_G - 1) / scale_G - event.xexpose.x / scale_G,
+						(event.xexpose.y + event.xexpose.height + scale_G - 1) / scale_G - event.xexpose.y / scale_G);
 				if (event.xexpose.count == 0)
 					x11_draw_main_win_from_offscreen ();
 				break;
 
+			case MapNotify:
+			case UnmapNotify:
+				if (event.xany.window == mon_pG->mainWin)
+					mon_pG->mainMapped = (event.type == MapNotify);
+				else if (event.xany.window == mon_pG->iconWin)
+					mon_pG->iconMapped = (event.type == MapNotify);
+				VERBOSE ("mapped: main:%d icon:%d\n", mon_pG->mainMapped, mon_pG->iconMapped);
+				break;
+
+			case ConfigureNotify:
+			case ReparentNotify:
+			case GravityNotify:
+			case CirculateNotify:
+			case DestroyNotify:
+				break;
+
 			case ClientMessage:
 				if ((event.xclient.message_type == wmProtocols_G) && ((Atom)event.xclient.data.l[0] == wmDelWin_G)) {
 					VERBOSE ("caught wmDelWin_G, closing\n");
@@ -668,41 +5566,240 @@ x11_check_events (void)
 
 			case VisibilityNotify:
 				VERBOSE ("visibility state: %d\n", event.xvisibility.state);
-				visible_G = ((event.xvisibility.state == VisibilityFullyObscured)? false : true);
+				// it wasn't drawn while it couldn't be seen
+				if (!mon_pG->visible && event.xvisibility.state != VisibilityFullyObscured)
+					mon_pG->drawnValid = false;
+				mon_pG->visible = ((event.xvisibility.state == VisibilityFullyObscured)? false : true);
+				// sampling stops only once none of the windows can be seen, see sched_sampling()
+				visible_G = false;
+				for (i=0; i<monitorCnt_G; ++i)
+					visible_G = visible_G || monitors_G[i].visible;
 				break;
 
 			default:
+#ifdef USE_SHM
+				// its drawable is where xany.window is, so monitor_select() found the monitor
+				if (event.type == fbCompletion_G) {
+					fb_completed ();
+					break;
+				}
+#endif
 				if (event.type != NoExpose)
 					printf ("unhandled X11 event: %d\n", event.type);
 				break;
 		}
 	}
+	mon_pG = &monitors_G[0];
 }
 
+/* hands the dirty part of the frame to the backend, in scaled pixels */
 static void
 x11_draw_main_win_from_offscreen (void)
 {
-	VERBOSE ("\n");
-	XCopyArea (dpy_pG, drawWin_G, mainWin_G, mainGC_G, 0, 0, backgroundXpm_G.attributes.width, backgroundXpm_G.attributes.height, 0, 0);
-	XCopyArea (dpy_pG, drawWin_G, iconWin_G, mainGC_G, 0, 0, backgroundXpm_G.attributes.width, backgroundXpm_G.attributes.height, 0, 0);
-	XFlush (dpy_pG);
+	unsigned w, h;
+	unsigned long written;
+	uint64_t start;
+
+	VERBOSE ("dirty: %d,%d - %d,%d\n", mon_pG->dirtyX0, mon_pG->dirtyY0, mon_pG->dirtyX1, mon_pG->dirtyY1);
+	if (mon_pG->dirtyX1 <= mon_pG->dirtyX0 || mon_pG->dirtyY1 <= mon_pG->dirtyY0) {
+		++statsEmpty_G;
+		return;
+	}
+	// Xlib writes the requests out from this thread, what it queued while drawing included
+	written = stats_written ();
+	start = sched_now ();
+
+	w = (unsigned)((mon_pG->dirtyX1 - mon_pG->dirtyX0) * scale_G);
+	h = (unsigned)((mon_pG->dirtyY1 - mon_pG->dirtyY0) * scale_G);
+	if (backend_pG->present_p != NULL)
+		backend_pG->present_p (mon_pG->dirtyX0 * scale_G, mon_pG->dirtyY0 * scale_G, w, h);
+	stats_record (&statsFlush_G, sched_now () - start);
+	if (dpy_pG != NULL) {
+		statsXBytes_G += stats_written () - written;
+		statsXRequests_G += XNextRequest (dpy_pG) - statsXSerial_G;
+		statsXSerial_G = XNextRequest (dpy_pG);
+	}
+
+	mon_pG->dirtyX0 = mon_pG->dirtyY0 = mon_pG->dirtyX1 = mon_pG->dirtyY1 = 0;
+}
+
+/* draws the current monitor's latest sample and puts it on the screen */
+static void
+x11_redraw (void)
+{
+	uint64_t start;
+
+	memcpy (&mon_pG->last, &mon_pG->fresh, sizeof (AsmemMeminfo_t));
+	start = sched_now ();
+	x11_draw_offscreen_win ();
+	stats_record (&statsDraw_G, sched_now () - start);
+	++statsRedraws_G;
+	x11_draw_main_win_from_offscreen ();
+}
+
+/*
+ * Works out where the numbers and the graph go for the selected modes.
+ * Only one thing fits in the graph area: the panel, the NUMA columns,
+ * the history or the process list, in that order of preference.
+ */
+static void
+x11_layout (void)
+{
+	int winWidth;
+	int tmp;
+
+	winWidth = (int)background_G.width - WIDTH_PADDING;
+	textFields_G[tMEMTOTAL] = (TextField_t){winWidth, MEMTOTAL_Y, -GLYPH_STEP, MAXDIGITS};
+	textFields_G[tMEMUSED] = (TextField_t){USED_X, MEMUSED_Y, GLYPH_STEP, USED_CELLS};
+	textFields_G[tMEMPCT] = (TextField_t){PCT_X, MEMUSED_Y, GLYPH_STEP, PCT_CELLS};
+	textFields_G[tSWPTOTAL] = (TextField_t){winWidth, SWPTOTAL_Y, -GLYPH_STEP, MAXDIGITS};
+	textFields_G[tSWPUSED] = (TextField_t){USED_X, SWPUSED_Y, GLYPH_STEP, USED_CELLS};
+	textFields_G[tSWPPCT] = (TextField_t){PCT_X, SWPUSED_Y, GLYPH_STEP, PCT_CELLS};
+	for (tmp=tTOPPID; tmp<tCOUNT; ++tmp)
+		textFields_G[tmp].cells = 0;
+
+	// the graph (or the panel) takes the place of everything below the total
+	if (history_G || netNodeCnt_G || numa_G || top_G) {
+		graphW_G = (int)background_G.width - GRAPH_X - GRAPH_PADDING;
+		graphH_G = (int)background_G.height - GRAPH_Y - GRAPH_PADDING;
+		for (tmp=tMEMTOTAL+1; tmp<tCOUNT; ++tmp)
+			textFields_G[tmp].cells = 0;
+	}
+	if (netNodeCnt_G) {
+		// the squarest grid that fits the local machine and the nodes
+		for (panelCols_G=1; (unsigned)(panelCols_G * panelCols_G) < netNodeCnt_G + 1; ++panelCols_G)
+			;
+		tileW_G = graphW_G / panelCols_G;
+		tileH_G = graphH_G / (int)((netNodeCnt_G + (unsigned)panelCols_G) / (unsigned)panelCols_G);
+	}
+	swpBarY_G = SWPBAR_Y;
+	if (top_G) {
+		// both bars right below the total, the list in the used/percent rows' layout below them
+		swpBarY_G = TOP_SWPBAR_Y;
+		for (tmp=0; tmp<TOP_ROWS; ++tmp) {
+			textFields_G[tTOPPID+tmp] = (TextField_t){USED_X, TOP_Y + tmp * TOP_ROW_H, GLYPH_STEP, USED_CELLS};
+			textFields_G[tTOPPCT+tmp] = (TextField_t){PCT_X, TOP_Y + tmp * TOP_ROW_H, GLYPH_STEP, PCT_CELLS};
+		}
+	}
+}
+
+/*
+ * Works out all the pixel values and the colours of the background and
+ * the alphabet. Without a display they're 32bit ARGB.
+ */
+static void
+x11_initialize_colours (void)
+{
+	XColor bg, fg, bar[4], shade, palette[4];
+	int tmp;
+
+	// resolve all the base colours up front, their shades are derived locally
+	x11_parse_colour (bgColour_G, &bg);
+	x11_parse_colour (fgColour_G, &fg);
+	x11_parse_colour (memoryColour_G, &bar[cMEM]);
+	x11_parse_colour (bufferColour_G, &bar[cBUF]);
+	x11_parse_colour (cacheColour_G, &bar[cCHE]);
+	x11_parse_colour (swapColour_G, &bar[cSWP]);
+	bgPix_G = x11_get_pixel (&bg);
+	fgPix_G = x11_get_pixel (&fg);
+	for (tmp=0; tmp<4; ++tmp) {
+		shade = x11_lighten_colour (bar[tmp], 14);
+		pix_G[tmp][cLGT] = x11_get_pixel (&shade);
+		pix_G[tmp][cREG] = x11_get_pixel (&bar[tmp]);
+		shade = x11_darken_colour (bar[tmp], 14);
+		pix_G[tmp][cDRK] = x11_get_pixel (&shade);
+	}
+
+	// colour in the background and the alphabet
+	palette[0] = x11_lighten_colour (bg, 25);
+	palette[1] = bg;
+	palette[2] = x11_darken_colour (bg, 12);
+	palette[3] = fg;
+	if (!x11_create_image (backgroundBits, BACKGROUND_WIDTH, BACKGROUND_HEIGHT, palette, &background_G)) {
+		printf ("asmem : can't create the background.\n");
+		cleanup ();
+		exit (1);
+	}
+	VERBOSE ("bg pixmap %d x %d\n", background_G.width, background_G.height);
+
+	palette[0] = bg;
+	palette[1] = fg;
+	palette[2] = x11_darken_colour (bg, 14);
+	palette[3] = x11_darken_colour (fg, 16);
+	if (!x11_create_image (alphabetBits, ALPHABET_WIDTH, ALPHABET_HEIGHT, palette, &alphabet_G)) {
+		printf ("asmem : can't create the alphabet.\n");
+		cleanup ();
+		exit (1);
+	}
+	palette[1] = bar[cSWP];
+	palette[3] = x11_darken_colour (bar[cSWP], 16);
+	if (!x11_create_image (alphabetBits, ALPHABET_WIDTH, ALPHABET_HEIGHT, palette, &etaAlphabet_G)) {
+		printf ("asmem : can't create the alphabet.\n");
+		cleanup ();
+		exit (1);
+	}
+}
+
+/* creates the current monitor's window, its icon and its offscreen pixmap */
+static void
+x11_create_windows (XSizeHints *hints_p, unsigned depth)
+{
+	XTextProperty title;
+	char name[FNAMESZ + 8];
+	char *name_p = name;
+	XClassHint classHint;
+	XWMHints WmHints;
+
+	// with more than one they need telling apart
+	if (monitorCnt_G > 1)
+		snprintf (name, sizeof (name), "asmem: %s", mon_pG->filename);
+	else
+		safe_copy (name, "asmem", sizeof (name));
+
+	mon_pG->drawWin = XCreatePixmap (dpy_pG, rootWin_G, (unsigned)hints_p->width, (unsigned)hints_p->height, depth);
+	mon_pG->mainWin = XCreateSimpleWindow (dpy_pG, rootWin_G, (int)hints_p->x, (int)hints_p->y, (unsigned)hints_p->width, (unsigned)hints_p->height, 0, fgPix_G, bgPix_G);
+	mon_pG->iconWin = XCreateSimpleWindow (dpy_pG, rootWin_G, (int)hints_p->x, (int)hints_p->y, (unsigned)hints_p->width, (unsigned)hints_p->height, 0, (unsigned)fgPix_G, (unsigned)bgPix_G);
+	XSetWMNormalHints (dpy_pG, mon_pG->mainWin, hints_p);
+	XClearWindow (dpy_pG, mon_pG->mainWin);
+
+	XSetWindowBackgroundPixmap (dpy_pG, mon_pG->mainWin, background_G.pixmap);
+	XSetWindowBackgroundPixmap (dpy_pG, mon_pG->iconWin, background_G.pixmap);
+
+	XStringListToTextProperty (&name_p, 1, &title);
+	XSetWMName (dpy_pG, mon_pG->mainWin, &title);
+	XSetWMName (dpy_pG, mon_pG->iconWin, &title);
+	XFree (title.value);
+
+	classHint.res_name = "asmem" ;
+	classHint.res_class = "ASMEM";
+	XSetClassHint (dpy_pG, mon_pG->mainWin, &classHint);
+	XStoreName (dpy_pG, mon_pG->mainWin, name);
+	XSetIconName (dpy_pG, mon_pG->mainWin, name);
+
+	XSelectInput (dpy_pG, mon_pG->mainWin, ExposureMask | VisibilityChangeMask | StructureNotifyMask);
+	XSelectInput (dpy_pG, mon_pG->iconWin, ExposureMask | StructureNotifyMask);
+
+	XSetWMProtocols (dpy_pG, mon_pG->mainWin, &wmDelWin_G, 1);
+	XSetWMProtocols (dpy_pG, mon_pG->iconWin, &wmDelWin_G, 1);
+
+	WmHints.flags = StateHint | IconWindowHint;
+	WmHints.initial_state = NormalState;
+	WmHints.icon_window = mon_pG->iconWin;
+	XSetWMHints (dpy_pG, mon_pG->mainWin, &WmHints);
+
+	// finally show the window
+	XMapWindow (dpy_pG, mon_pG->mainWin);
 }
 
 static void
 x11_initialize (int argc, char *argv[])
 {
 	int screen;
-	Status status;
-	XWindowAttributes winAttr;
 	XSizeHints SizeHints;
-	XTextProperty title;
-	char *appName_p = "asmem";
-	XClassHint classHint;
 	int gravity;
-	XWMHints WmHints;
-	XEvent Event;
+	char *atomNames[2] = {"WM_DELETE_WINDOW", "WM_PROTOCOLS"};
+	Atom atoms[2];
 	unsigned colourDepth;
-	int tmp;
 	int result;
 	int x_negative = 0;
 	int y_negative = 0;
@@ -713,43 +5810,17 @@ x11_initialize (int argc, char *argv[])
 			XDisplayName (displayName_G));
 		exit (1);
 	}
+	statsIoFd_G = open ("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
 	screen = DefaultScreen (dpy_pG);
 	rootWin_G = RootWindow (dpy_pG, screen);
-	bgPix_G = x11_get_colour (bgColour_G, rootWin_G);
-	fgPix_G = x11_get_colour (fgColour_G, rootWin_G);
+	colormap_G = DefaultColormap (dpy_pG, screen);
+	visual_pG = DefaultVisual (dpy_pG, screen);
 	colourDepth = (unsigned)DefaultDepth (dpy_pG, screen);
 	VERBOSE ("asmem : detected colour depth %u bpp, using %u bpp\n", colourDepth, colourDepth);
+	if (scaleAuto_G)
+		scale_G = x11_detect_scale ();
 
-	// adjust the background pixmap
-	sprintf (pgPixColour_G[3], "# c %s", fgColour_G);
-	sprintf (pgPixColour_G[2], "q c %s", x11_darken_char_colour (bgColour_G, 1.2, rootWin_G));
-	sprintf (pgPixColour_G[1], "c c %s", bgColour_G);
-	sprintf (pgPixColour_G[0], ". c %s", x11_lighten_char_colour (bgColour_G, 2.5, rootWin_G));
-	for (tmp=0; tmp<4; ++tmp)
-		background[tmp+1] = pgPixColour_G[tmp];
-
-	backgroundXpm_G.attributes.valuemask |= (XpmReturnPixels | XpmReturnExtensions);
-	status = XpmCreatePixmapFromData (dpy_pG, rootWin_G, background, &backgroundXpm_G.pixmap, &backgroundXpm_G.mask, &backgroundXpm_G.attributes);
-	if (status != XpmSuccess) {
-		printf ("asmem : (%d) not enough free colour cells for background.\n", status);
-		cleanup ();
-		exit (1);
-	}
-	VERBOSE ("bg pixmap %d x %d\n", backgroundXpm_G.attributes.width, backgroundXpm_G.attributes.height);
-
-	sprintf (alphaColour_G[0], ". c %s", bgColour_G);
-	sprintf (alphaColour_G[1], "# c %s", fgColour_G);
-	sprintf (alphaColour_G[2], "a c %s", x11_darken_char_colour (bgColour_G, 1.4, rootWin_G));
-	sprintf (alphaColour_G[3], "c c %s", x11_darken_char_colour (fgColour_G, 1.6, rootWin_G));
-	for (tmp=0; tmp<4; ++tmp)
-		alphabet[tmp+1] = alphaColour_G[tmp];
-	alphabetXpm_G.attributes.valuemask |= (XpmReturnPixels | XpmReturnExtensions);
-	status = XpmCreatePixmapFromData (dpy_pG, rootWin_G, alphabet, &alphabetXpm_G.pixmap, &alphabetXpm_G.mask, &alphabetXpm_G.attributes);
-	if (status != XpmSuccess) {
-		printf ("asmem : (%d) not enough free colour cells for alphabet.\n", status);
-		XCloseDisplay (dpy_pG);
-		exit (1);
-	}
+	x11_initialize_colours ();
 
 	if (strlen (mainGeometry_G)) {
 		// check the user-specified size
@@ -764,8 +5835,8 @@ x11_initialize (int argc, char *argv[])
 	SizeHints.x = 0;
 	SizeHints.y = 0;
 	XWMGeometry (dpy_pG, screen, mainGeometry_G, NULL, 1, & SizeHints, &SizeHints.x, &SizeHints.y, &SizeHints.width, &SizeHints.height, &gravity);
-	SizeHints.min_width = SizeHints.max_width = SizeHints.width = (int)backgroundXpm_G.attributes.width;
-	SizeHints.min_height = SizeHints.max_height = SizeHints.height = (int)backgroundXpm_G.attributes.height;
+	SizeHints.min_width = SizeHints.max_width = SizeHints.width = (int)background_G.width * scale_G;
+	SizeHints.min_height = SizeHints.max_height = SizeHints.height = (int)background_G.height * scale_G;
 	SizeHints.flags |= PMinSize|PMaxSize;
 
 	// correct the offsets if the X/Y are negative
@@ -783,29 +5854,6 @@ x11_initialize (int argc, char *argv[])
 	}
 	SizeHints.flags |= PWinGravity;
 
-	drawWin_G = XCreatePixmap (dpy_pG, rootWin_G, (unsigned)SizeHints.width, (unsigned)SizeHints.height, colourDepth);
-	mainWin_G = XCreateSimpleWindow (dpy_pG, rootWin_G, (int)SizeHints.x, (int)SizeHints.y, (unsigned)SizeHints.width, (unsigned)SizeHints.height, 0, fgPix_G, bgPix_G);
-	iconWin_G = XCreateSimpleWindow (dpy_pG, rootWin_G, (int)SizeHints.x, (int)SizeHints.y, (unsigned)SizeHints.width, (unsigned)SizeHints.height, 0, (unsigned)fgPix_G, (unsigned)bgPix_G);
-	XSetWMNormalHints (dpy_pG, mainWin_G, &SizeHints);
-	status = XClearWindow (dpy_pG, mainWin_G);
-
-	status = XGetWindowAttributes (dpy_pG, mainWin_G, &winAttr);
-	status = XSetWindowBackgroundPixmap (dpy_pG, mainWin_G, backgroundXpm_G.pixmap);
-	status = XSetWindowBackgroundPixmap (dpy_pG, iconWin_G, backgroundXpm_G.pixmap);
-
-	status = XStringListToTextProperty (&appName_p, 1, &title);
-	XSetWMName (dpy_pG, mainWin_G, &title);
-	XSetWMName (dpy_pG, iconWin_G, &title);
-
-	classHint.res_name = "asmem" ;
-	classHint.res_class = "ASMEM";
-	XSetClassHint (dpy_pG, mainWin_G, &classHint);
-	XStoreName (dpy_pG, mainWin_G, "asmem");
-	XSetIconName (dpy_pG, mainWin_G, "asmem");
-
-	status = XSelectInput (dpy_pG, mainWin_G, ExposureMask | VisibilityChangeMask);
-	status = XSelectInput (dpy_pG, iconWin_G, ExposureMask);
-
 	// creating GC
 	mainGCV_G.foreground = fgPix_G;
 	mainGCV_G.background = bgPix_G;
@@ -813,52 +5861,477 @@ x11_initialize (int argc, char *argv[])
 	mainGCV_G.line_style = LineSolid;
 	mainGCV_G.fill_style = FillSolid;
 	mainGCV_G.line_width = 1;
-	mainGC_G = XCreateGC (dpy_pG, mainWin_G, GCForeground|GCBackground|GCLineWidth|GCLineStyle|GCFillStyle, &mainGCV_G);
+	mainGC_G = XCreateGC (dpy_pG, rootWin_G, GCForeground|GCBackground|GCLineWidth|GCLineStyle|GCFillStyle, &mainGCV_G);
 
-	status = XSetCommand (dpy_pG, mainWin_G, argv, argc);
+	// set up the event for quitting the window, both atoms in one go
+	XInternAtoms (dpy_pG, atomNames, 2, False, atoms);
+	wmDelWin_G = atoms[0];
+	wmProtocols_G = atoms[1];
 
-	// set up the event for quitting the window
-	wmDelWin_G = XInternAtom (dpy_pG, "WM_DELETE_WINDOW", False);
-	wmProtocols_G = XInternAtom (dpy_pG, "WM_PROTOCOLS", False);
-	status = XSetWMProtocols (dpy_pG, mainWin_G, &wmDelWin_G, 1);
-	status = XSetWMProtocols (dpy_pG, iconWin_G, &wmDelWin_G, 1);
+	// the monitors' windows side by side, the first one where asked
+	for (mon_pG=monitors_G; mon_pG<monitors_G+monitorCnt_G; ++mon_pG) {
+		x11_create_windows (&SizeHints, colourDepth);
+		SizeHints.x += x_negative ? -SizeHints.width : SizeHints.width;
+	}
+	mon_pG = &monitors_G[0];
+	// the session manager restarts us as a whole
+	XSetCommand (dpy_pG, mon_pG->mainWin, argv, argc);
 
-	WmHints.flags = StateHint | IconWindowHint;
-	WmHints.initial_state = NormalState;
-	WmHints.icon_window = iconWin_G;
-	XSetWMHints (dpy_pG, mainWin_G, &WmHints);
+	if (framebuffer_G) {
+		if (fb_initialize ())
+			backend_pG = &shmBackend_G;
+		else
+			printf ("asmem: can't render client-side, drawing on the server\n");
+	}
+	if (backend_pG == &xlibBackend_G)
+		x11_create_bar_strips ();
 
-	// finally show the window
-	status = XMapWindow (dpy_pG, mainWin_G);
-
-	// get colours while waiting for Expose
-	pix_G[cMEM][cLGT] = x11_lighten_colour (memoryColour_G, 1.4, mainWin_G);
-	pix_G[cMEM][cREG] = x11_get_colour (memoryColour_G, mainWin_G);
-	pix_G[cMEM][cDRK] = x11_darken_colour (memoryColour_G, 1.4, mainWin_G);
-	pix_G[cBUF][cLGT] = x11_lighten_colour (bufferColour_G, 1.4, mainWin_G);
-	pix_G[cBUF][cREG] = x11_get_colour (bufferColour_G, mainWin_G);
-	pix_G[cBUF][cDRK] = x11_darken_colour (bufferColour_G, 1.4, mainWin_G);
-	pix_G[cCHE][cLGT] = x11_lighten_colour (cacheColour_G, 1.4, mainWin_G);
-	pix_G[cCHE][cREG] = x11_get_colour (cacheColour_G, mainWin_G);
-	pix_G[cCHE][cDRK] = x11_darken_colour (cacheColour_G, 1.4, mainWin_G);
-	pix_G[cSWP][cLGT] = x11_lighten_colour (swapColour_G, 1.4, mainWin_G);
-	pix_G[cSWP][cREG] = x11_get_colour (swapColour_G, mainWin_G);
-	pix_G[cSWP][cDRK] = x11_darken_colour (swapColour_G, 1.4, mainWin_G);
-
-	if (!open_meminfo ()) {
+	// the setup isn't counted against the first frame
+	XFlush (dpy_pG);
+	statsXSerial_G = XNextRequest (dpy_pG);
+	x11_initialize_frame ();
+	XFlush (dpy_pG);
+}
+
+/* --scale auto: the Xft.dpi resource, which desktops set for HiDPI screens */
+static int
+x11_detect_scale (void)
+{
+	const char *res_p = XResourceManagerString (dpy_pG);
+	const char *p;
+	int scale;
+
+	if (res_p == NULL || (p = strstr (res_p, "Xft.dpi:")) == NULL)
+		return 1;
+	scale = (int)(strtod (p + 8, NULL) / SCALE_DPI + 0.5);
+	if (scale < 1)
+		scale = 1;
+	if (scale > SCALE_MAX)
+		scale = SCALE_MAX;
+	VERBOSE ("Xft.dpi says scale %d\n", scale);
+	return scale;
+}
+
+/*
+ * The part of starting up which doesn't depend on where frames go: the
+ * layout, whatever the selected mode needs, and the first sample and frame.
+ */
+static void
+x11_initialize_frame (void)
+{
+	VERBOSE ("drawing with the %s backend\n", backend_pG->name_p);
+	x11_layout ();
+	if (netNodeCnt_G)
+		net_reconnect (sched_now ());
+	else if (top_G && !top_initialize ()) {
 		cleanup ();
 		exit (1);
 	}
-	if (!read_meminfo ()) {
+
+	for (mon_pG=monitors_G; mon_pG<monitors_G+monitorCnt_G; ++mon_pG) {
+		if (history_G && !netNodeCnt_G && !history_initialize ((unsigned)graphW_G)) {
+			cleanup ();
+			exit (1);
+		}
+		if (!open_meminfo ()) {
+			cleanup ();
+			exit (1);
+		}
+		if (!read_meminfo ()) {
+			cleanup ();
+			exit (1);
+		}
+	}
+	mon_pG = &monitors_G[0];
+	if (numa_G && !numa_initialize ()) {
+		cleanup ();
+		exit (1);
+	}
+	if (cgroupPath_G[0] != 0 && !cgroup_open (cgroupPath_G)) {
 		cleanup ();
 		exit (1);
 	}
 
-	// wait for the Expose event now
-	XNextEvent (dpy_pG, &Event);
-
-	// we've got Expose -> draw the parts of the window
+	/*
+	 * Draw the first frame right away rather than blocking until the
+	 * window manager gets around to mapping us; the Expose handler
+	 * copies it to the window once it's visible.
+	 */
 	meminfo_update ();
-	x11_draw_main_win_from_offscreen ();
+}
+
+/* ------------------------------------------------------------------------- */
+// client-side framebuffer
+/* ------------------------------------------------------------------------- */
+/* expands one of the indexed bitmaps into pixel values to blit from, scale_G times the size */
+static uint32_t*
+fb_decode_image (const AsmemImage_t *image_p)
+{
+	uint32_t *pixels_p;
+	unsigned x, y, s = (unsigned)scale_G;
+	unsigned w = image_p->width * s;
+
+	pixels_p = (uint32_t*)malloc (w * image_p->height * s * sizeof (uint32_t));
+	if (pixels_p != NULL)
+		for (y=0; y<image_p->height*s; ++y)
+			for (x=0; x<w; ++x)
+				pixels_p[y * w + x] = (uint32_t)image_p->palette[ATLAS_INDEX (image_p->bits_p, image_p->width, x / s, y / s)];
+
+	return pixels_p;
+}
+
+#ifdef USE_SHM
+static int
+fb_trap_error (Display *dpy_p, XErrorEvent *event_p)
+{
+	(void)dpy_p;
+	(void)event_p;
+	fbError_G = true;
+	return 0;
+}
+#endif
+
+/*
+ * Creates the frame image, in a shared memory segment if the server
+ * supports MIT-SHM (which it only does for local clients) and otherwise
+ * in ordinary memory to be sent with XPutImage.
+ */
+static bool
+fb_create_image (unsigned w, unsigned h)
+{
+	int screen = DefaultScreen (dpy_pG);
+	Visual *visual_p = DefaultVisual (dpy_pG, screen);
+	unsigned depth = (unsigned)DefaultDepth (dpy_pG, screen);
+	char *data_p;
+
+#ifdef USE_SHM
+	if (XShmQueryExtension (dpy_pG)) {
+		int (*oldHandler_p)(Display*, XErrorEvent*);
+
+		mon_pG->fbImage_p = XShmCreateImage (dpy_pG, visual_p, depth, ZPixmap, NULL, &mon_pG->fbShmInfo, w, h);
+		if (mon_pG->fbImage_p != NULL) {
+			mon_pG->fbShmInfo.shmid = shmget (IPC_PRIVATE, (size_t)mon_pG->fbImage_p->bytes_per_line * h, IPC_CREAT | 0600);
+			if (mon_pG->fbShmInfo.shmid != -1) {
+				mon_pG->fbShmInfo.shmaddr = mon_pG->fbImage_p->data = (char*)shmat (mon_pG->fbShmInfo.shmid, NULL, 0);
+				mon_pG->fbShmInfo.readOnly = True;
+				if (mon_pG->fbShmInfo.shmaddr != (char*)-1) {
+					fbError_G = false;
+					oldHandler_p = XSetErrorHandler (fb_trap_error);
+					XShmAttach (dpy_pG, &mon_pG->fbShmInfo);
+					XSync (dpy_pG, False);
+					XSetErrorHandler (oldHandler_p);
+					mon_pG->fbShm = !fbError_G;
+					if (!mon_pG->fbShm)
+						shmdt (mon_pG->fbShmInfo.shmaddr);
+					else
+						fbCompletion_G = XShmGetEventBase (dpy_pG) + ShmCompletion;
+				}
+				// the segment goes away once both sides have detached
+				shmctl (mon_pG->fbShmInfo.shmid, IPC_RMID, NULL);
+			}
+			if (!mon_pG->fbShm) {
+				mon_pG->fbImage_p->data = NULL;
+				XDestroyImage (mon_pG->fbImage_p);
+				mon_pG->fbImage_p = NULL;
+			}
+		}
+	}
+	if (mon_pG->fbImage_p != NULL)
+		return true;
+#endif
+
+	mon_pG->fbImage_p = XCreateImage (dpy_pG, visual_p, depth, ZPixmap, 0, NULL, w, h, 32, 0);
+	if (mon_pG->fbImage_p == NULL)
+		return false;
+	data_p = (char*)malloc ((size_t)mon_pG->fbImage_p->bytes_per_line * h);
+	if (data_p == NULL) {
+		XDestroyImage (mon_pG->fbImage_p);
+		mon_pG->fbImage_p = NULL;
+		return false;
+	}
+	mon_pG->fbImage_p->data = data_p;
+	return true;
+}
+
+static bool
+fb_initialize (void)
+{
+	const uint32_t one = 1;
+	int nativeOrder = (*(const unsigned char*)&one == 1) ? LSBFirst : MSBFirst;
+
+	// one frame per monitor, all or nothing
+	fbWidth_G = (int)background_G.width * scale_G;
+	fbHeight_G = (int)background_G.height * scale_G;
+	for (mon_pG=monitors_G; mon_pG<monitors_G+monitorCnt_G; ++mon_pG) {
+		if (!fb_create_image ((unsigned)fbWidth_G, (unsigned)fbHeight_G))
+			break;
+
+		// pixels are written as native 32bit words
+		if (mon_pG->fbImage_p->bits_per_pixel != 32 || mon_pG->fbImage_p->byte_order != nativeOrder) {
+			VERBOSE ("unsupported image format: %d bpp, byte order %d\n", mon_pG->fbImage_p->bits_per_pixel, mon_pG->fbImage_p->byte_order);
+			break;
+		}
+		mon_pG->fbPixels_p = (uint32_t*)mon_pG->fbImage_p->data;
+		mon_pG->fbStride = mon_pG->fbImage_p->bytes_per_line / 4;
+	}
+	if (mon_pG != monitors_G + monitorCnt_G) {
+		fb_cleanup ();
+		return false;
+	}
+	mon_pG = &monitors_G[0];
+
+	fbBackground_pG = fb_decode_image (&background_G);
+	fbAlphabet_pG = fb_decode_image (&alphabet_G);
+	fbEtaAlphabet_pG = fb_decode_image (&etaAlphabet_G);
+	if (fbBackground_pG == NULL || fbAlphabet_pG == NULL || fbEtaAlphabet_pG == NULL) {
+		fb_cleanup ();
+		return false;
+	}
+
+	VERBOSE ("client-side rendering, %s\n", mon_pG->fbShm ? "MIT-SHM" : "XPutImage");
+	return true;
+}
+
+/* the same, in ordinary memory, for when there's no display */
+static bool
+fb_initialize_memory (void)
+{
+	fbWidth_G = mon_pG->fbStride = (int)background_G.width * scale_G;
+	fbHeight_G = (int)background_G.height * scale_G;
+	mon_pG->fbPixels_p = (uint32_t*)calloc ((size_t)(mon_pG->fbStride * fbHeight_G), sizeof (uint32_t));
+	fbBackground_pG = fb_decode_image (&background_G);
+	fbAlphabet_pG = fb_decode_image (&alphabet_G);
+	fbEtaAlphabet_pG = fb_decode_image (&etaAlphabet_G);
+	if (mon_pG->fbPixels_p == NULL || fbBackground_pG == NULL || fbAlphabet_pG == NULL || fbEtaAlphabet_pG == NULL) {
+		perror ("malloc()");
+		fb_cleanup ();
+		return false;
+	}
+	return true;
+}
+
+/* --snapshot: no display at all, every frame is written to a file */
+static void
+fb_initialize_snapshot (void)
+{
+	x11_initialize_colours ();
+	if (!fb_initialize_memory ())
+		exit (1);
+	// "P6\n<w> <h>\n255\n" and 3 bytes per pixel
+	if ((fbPpm_pG = (unsigned char*)malloc (32 + (size_t)(fbWidth_G * fbHeight_G) * 3)) == NULL) {
+		perror ("malloc()");
+		exit (1);
+	}
+	ppmBackend_G = memoryBackend_G;
+	ppmBackend_G.name_p = "ppm";
+	ppmBackend_G.present_p = fb_write_ppm;
+	backend_pG = &ppmBackend_G;
+	x11_initialize_frame ();
+}
+
+static void
+fb_cleanup (void)
+{
+	for (mon_pG=monitors_G; mon_pG<monitors_G+monitorCnt_G; ++mon_pG) {
+		if (mon_pG->fbImage_p == NULL)
+			free (mon_pG->fbPixels_p);
+		mon_pG->fbPixels_p = NULL;
+		if (mon_pG->fbImage_p != NULL) {
+#ifdef USE_SHM
+			if (mon_pG->fbShm) {
+				XShmDetach (dpy_pG, &mon_pG->fbShmInfo);
+				shmdt (mon_pG->fbShmInfo.shmaddr);
+				mon_pG->fbImage_p->data = NULL;
+				mon_pG->fbShm = false;
+			}
+#endif
+			XDestroyImage (mon_pG->fbImage_p);
+			mon_pG->fbImage_p = NULL;
+		}
+	}
+	mon_pG = &monitors_G[0];
+	free (fbBackground_pG);
+	free (fbAlphabet_pG);
+	free (fbEtaAlphabet_pG);
+	fbBackground_pG = fbAlphabet_pG = fbEtaAlphabet_pG = NULL;
+	free (fbPpm_pG);
+	fbPpm_pG = NULL;
+}
+
+/* copies a w x h block out of a pixel array into the frame, in scaled pixels */
+static void
+fb_blit (const uint32_t *src_p, int srcStride, int sx, int sy, int w, int h, int dx, int dy)
+{
+	int row;
+
+	if (dx < 0) {
+		sx -= dx;
+		w += dx;
+		dx = 0;
+	}
+	if (dx + w > fbWidth_G)
+		w = fbWidth_G - dx;
+	if (dy + h > fbHeight_G)
+		h = fbHeight_G - dy;
+	if (w <= 0 || dy < 0)
+		return;
+
+	for (row=0; row<h; ++row)
+		memcpy (mon_pG->fbPixels_p + (dy + row) * mon_pG->fbStride + dx,
+			src_p + (sy + row) * srcStride + sx, (size_t)w * sizeof (uint32_t));
+}
+
+static void
+fb_fill (uint32_t pixel, int x, int y, int w, int h)
+{
+	uint32_t *row_p;
+	int row, col;
+
+	if (x + w > fbWidth_G)
+		w = fbWidth_G - x;
+	if (y + h > fbHeight_G)
+		h = fbHeight_G - y;
+
+	for (row=0; row<h; ++row) {
+		row_p = mon_pG->fbPixels_p + (y + row) * mon_pG->fbStride + x;
+		for (col=0; col<w; ++col)
+			row_p[col] = pixel;
+	}
+}
+
+/* the framebuffer backends' drawing primitives, scaled */
+static void
+fb_scroll (int x, int y, int w, int h)
+{
+	int row, s = scale_G;
+
+	for (row=y*s; row<(y+h)*s; ++row)
+		memmove (mon_pG->fbPixels_p + row * mon_pG->fbStride + x * s,
+			mon_pG->fbPixels_p + row * mon_pG->fbStride + (x + 1) * s, (size_t)((w - 1) * s) * sizeof (uint32_t));
+}
+
+static void
+fb_blit_background (int x, int y, int w, int h)
+{
+	int s = scale_G;
+
+	fb_blit (fbBackground_pG, (int)background_G.width * s, x * s, y * s, w * s, h * s, x * s, y * s);
+}
+
+static void
+fb_blit_glyph (int glyph, int x, int y)
+{
+	const uint32_t *src_p = glyph >= GLYPH_ETA ? fbEtaAlphabet_pG : fbAlphabet_pG;
+	int s = scale_G;
+
+	fb_blit (src_p, (int)alphabet_G.width * s, glyph % GLYPH_ETA * GLYPH_STEP * s, 0, GLYPH_W * s, GLYPH_H * s, x * s, y * s);
+}
+
+static void
+fb_blit_bar (unsigned colour, int x, int y, int w)
+{
+	int hue, s = scale_G;
+
+	for (hue=0; hue<BAR_ROWS; ++hue)
+		fb_fill ((uint32_t)pix_G[colour][hue], x * s, (y + hue) * s, w * s, s);
+}
+
+static void
+fb_blit_fill (Pixel pixel, int x, int y, int w, int h)
+{
+	int s = scale_G;
+
+	if (w > 0 && h > 0)
+		fb_fill ((uint32_t)pixel, x * s, y * s, w * s, h * s);
+}
+
+/*
+ * Uploads part of the frame to a window. The server reads a shared
+ * segment whenever it gets round to it, so a ShmCompletion is asked for
+ * and nothing is composed into it until they're all back.
+ */
+static void
+fb_put (Window win, int x, int y, unsigned w, unsigned h)
+{
+#ifdef USE_SHM
+	if (mon_pG->fbShm) {
+		XShmPutImage (dpy_pG, win, mainGC_G, mon_pG->fbImage_p, x, y, x, y, w, h, True);
+		++mon_pG->fbInFlight;
+		return;
+	}
+#endif
+	XPutImage (dpy_pG, win, mainGC_G, mon_pG->fbImage_p, x, y, x, y, w, h);
+}
+
+static void
+fb_present (int x, int y, unsigned w, unsigned h)
+{
+	// an unmapped window gets all of it on its next Expose
+	if (!mon_pG->mainMapped && !mon_pG->iconMapped)
+		return;
+	if (mon_pG->mainMapped)
+		fb_put (mon_pG->mainWin, x, y, w, h);
+	if (mon_pG->iconMapped)
+		fb_put (mon_pG->iconWin, x, y, w, h);
 	XFlush (dpy_pG);
 }
+
+#ifdef USE_SHM
+/* the server is done with one of the current monitor's puts, the frame held back goes out after the last */
+static void
+fb_completed (void)
+{
+	if (mon_pG->fbInFlight)
+		--mon_pG->fbInFlight;
+	if (mon_pG->fbInFlight == 0 && mon_pG->fbDeferred) {
+		mon_pG->fbDeferred = false;
+		x11_redraw ();
+	}
+}
+#endif
+
+/*
+ * Writes the whole frame to snapshotFilename_G as a binary PPM. It goes
+ * to a temporary file first and is renamed into place, so whoever reads
+ * it never sees half a frame.
+ */
+static void
+fb_write_ppm (int x, int y, unsigned w, unsigned h)
+{
+	char tmpName[FNAMESZ + 4];
+	unsigned char *p;
+	const uint32_t *row_p;
+	int fd, row, col;
+	size_t len;
+
+	(void)x;
+	(void)y;
+	(void)w;
+	(void)h;
+
+	p = fbPpm_pG + sprintf ((char*)fbPpm_pG, "P6\n%d %d\n255\n", fbWidth_G, fbHeight_G);
+	for (row=0; row<fbHeight_G; ++row) {
+		row_p = mon_pG->fbPixels_p + row * mon_pG->fbStride;
+		for (col=0; col<fbWidth_G; ++col) {
+			*p++ = (unsigned char)(row_p[col] >> 16);
+			*p++ = (unsigned char)(row_p[col] >> 8);
+			*p++ = (unsigned char)row_p[col];
+		}
+	}
+	len = (size_t)(p - fbPpm_pG);
+
+	snprintf (tmpName, sizeof (tmpName), "%s.tmp", snapshotFilename_G);
+	if ((fd = open (tmpName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+		perror ("open()");
+		return;
+	}
+	if (write (fd, fbPpm_pG, len) != (ssize_t)len) {
+		perror ("write()");
+		close (fd);
+		unlink (tmpName);
+		return;
+	}
+	close (fd);
+	if (rename (tmpName, snapshotFilename_G) == -1)
+		perror ("rename()");
+}
@@ -7,24 +7,271 @@
 #ifndef asmem__H
 #define asmem__H
 
-#include <X11/xpm.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <X11/Xlib.h>
 
 // file to read for memory info
 #define PROC_MEM "/proc/meminfo"
 
+/*
+ * The /proc/meminfo fields asmem reads, as X(member, key). They make up
+ * AsmemMeminfo_t and the parser's table, in this order; adding a field
+ * is adding a line. All of them must be in kB. The first MEMINFO_BASE
+ * are all that binary records carry, and all that older agents send.
+ */
+#define MEMINFO_FIELDS(X) \
+	X(memTotal, "MemTotal")		/* total memory available */ \
+	X(memFree, "MemFree")		/* free memory */ \
+	X(memBuffers, "Buffers")	/* buffers memory */ \
+	X(memCached, "Cached")		/* cached memory */ \
+	X(swapTotal, "SwapTotal")	/* total swap space */ \
+	X(swapFree, "SwapFree")		/* free swap space */ \
+	X(memAvailable, "MemAvailable")	/* the kernel's estimate, since 3.14 */ \
+	X(shmem, "Shmem") \
+	X(slab, "Slab") \
+	X(slabReclaimable, "SReclaimable") \
+	X(dirty, "Dirty") \
+	X(writeback, "Writeback") \
+	X(anonPages, "AnonPages") \
+	X(anonHugePages, "AnonHugePages") \
+	X(hugetlb, "Hugetlb") \
+	X(zswap, "Zswap")		/* zswap's pool, since 5.19 */ \
+	X(zswapped, "Zswapped")		/* what's in it, uncompressed */
+#define MEMINFO_BASE 6
+#define MEMINFO_ONE(member, key) + 1
+#define MEMINFO_COUNT (0 MEMINFO_FIELDS (MEMINFO_ONE))
+
+// values are in (roughly) MB
+#define MEMINFO_MEMBER(member, key) unsigned long member;
 typedef struct {
-	unsigned long memTotal;		/* total memory available */
-	unsigned long memFree;		/* free memory */
-	unsigned long memBuffers;	/* buffers memory */
-	unsigned long memCached;	/* cached memory */
-	unsigned long swapTotal;	/* total swap space */
-	unsigned long swapFree;		/* free swap space */
+	MEMINFO_FIELDS (MEMINFO_MEMBER)
 } AsmemMeminfo_t;
 
+// the fixed-layout record written by --headless --format binary
+typedef struct {
+	uint64_t time;			/* CLOCK_REALTIME [ns] */
+	uint64_t field[MEMINFO_BASE];	/* AsmemMeminfo_t, in order */
+} AsmemRecord_t;
+
+/*
+ * The segment shared by --publish and --subscribe. seq is a seqlock,
+ * odd while the sample is being written, and also the futex word the
+ * subscribers sleep on. Values are in host byte order.
+ */
+#define SHM_MAGIC 0x6173686d		/* "ashm" */
+#define SHM_VERSION 1
+#define SHM_MAXFIELDS 32
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	uint32_t interval;		/* the publisher's [ms] */
+	uint32_t fieldCnt;		/* valid entries of field[] */
+	uint32_t pid;			/* of the publisher */
+	uint64_t time;			/* of the sample [ns, CLOCK_REALTIME] */
+	uint64_t field[SHM_MAXFIELDS];	/* AsmemMeminfo_t, in order */
+} AsmemShm_t;
+
+/*
+ * A --record file: an AsmemRecHeader_t in a block of its own, then a
+ * ring of blockCnt blocks. Each block is an AsmemRecBlock_t followed by
+ * records and zeros; it can be decoded without any of the others, so
+ * the oldest one is simply overwritten. A record is a length byte
+ * (0 ends the block), that many bytes of payload and a check byte:
+ *
+ *	varint	zigzag (ms since the previous record - interval),
+ *		since the block's time for the first one
+ *	varint	bit mask of the fields which changed
+ *	varint	zigzag (change) of each of those fields
+ *
+ * The first record of a block holds the values themselves (changes from
+ * 0). The length byte is written last, so a record is either complete or
+ * not there; the check byte catches one torn by a crash of the machine.
+ * Values are in host byte order.
+ */
+#define REC_MAGIC 0x61726563		/* "arec" */
+#define REC_VERSION 1
+#define REC_MAXFIELDS 64		/* bits in the mask */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t blockSize;		/* [bytes] */
+	uint32_t blockCnt;
+	uint32_t fieldCnt;		/* AsmemMeminfo_t fields per record, in order */
+	uint32_t interval;		/* the recorder's [ms] */
+} AsmemRecHeader_t;
+
+typedef struct {
+	uint64_t seq;			/* the blocks are started 1, 2, ..., 0 is unused */
+	uint64_t time;			/* of its first record [ms, CLOCK_REALTIME] */
+} AsmemRecBlock_t;
+
+// a sample on its way to the recorder thread
+typedef struct {
+	uint64_t time;			/* [ms, CLOCK_REALTIME] */
+	AsmemMeminfo_t info;
+} AsmemRecSample_t;
+
+/*
+ * --agent/--view framing: each frame is a type byte, a payload length
+ * byte and the payload. Integers are big-endian.
+ */
+#define NET_HELLO 1			/* payload: the node's name */
+#define NET_SAMPLE 2			/* payload: time [ns] (64 bits), then the
+					   AsmemMeminfo_t fields (32 bits each) */
+#define NET_SAMPLE_MINLEN (8 + MEMINFO_BASE * 4)	/* older agents send no more */
+#define NET_NAMESZ 32
+
+// a node followed by --view
+typedef struct {
+	char addr[256];			/* where its agent listens */
+	char name[NET_NAMESZ];		/* what it calls itself */
+	int fd;				/* -1 while not connected */
+	bool connecting;		/* non-blocking connect() in progress */
+	uint64_t retry;			/* when to reconnect [ns, CLOCK_MONOTONIC] */
+	unsigned char rx[2 + 255];	/* partial frame */
+	unsigned rxLen;
+	bool valid;			/* info holds a sample */
+	bool dirty;			/* info changed since it was drawn */
+	uint64_t time;			/* of the sample [ns, CLOCK_REALTIME] */
+	AsmemMeminfo_t info;
+} AsmemNode_t;
+
+// a scrape of the --metrics socket
+typedef struct {
+	int fd;
+	uint64_t since;			/* accepted [ns, CLOCK_MONOTONIC] */
+	char rx[1024];			/* the request, only its first line matters */
+	unsigned rxLen;
+	int buf;			/* the metrics buffer it's sent from, or -1 */
+	const char *tx_p;		/* what's left of the response, NULL while reading */
+	size_t txLen;
+} AsmemScrape_t;
+
+// a swap device of /proc/swaps, for --swaps
+typedef struct {
+	char path[128];
+	char type[16];			/* partition, file */
+	int mmStatFd;			/* a zram device's mm_stat, -1 for the others */
+	bool seen;			/* in the latest /proc/swaps */
+	unsigned long size, used;	/* in (roughly) MB */
+	unsigned long orig, compr;	/* zram: what's stored, and the memory it takes */
+} AsmemSwapDev_t;
+
+// a NUMA node shown by --numa
+typedef struct {
+	unsigned id;			/* the n of /sys/devices/system/node/node<n> */
+	int meminfoFd;
+	int numastatFd;
+	AsmemMeminfo_t info;		/* memTotal, memFree, memCached (FilePages) */
+	AsmemMeminfo_t drawn;		/* what its column shows */
+	unsigned long localNode;	/* numastat counters, in pages */
+	unsigned long otherNode;
+} AsmemNumaNode_t;
+
+// a process tracked by --top
+typedef struct {
+	int pid;
+	int fd;				/* its statm, -1 if it couldn't be kept open */
+	unsigned long rss;		/* resident set [pages] */
+} AsmemProc_t;
+
+// a latency histogram of the self-instrumentation
+#define STATS_BUCKETS 16
+typedef struct {
+	const char *name_p;
+	uint64_t count;
+	uint64_t sum;			/* [ns] */
+	uint64_t max;			/* [ns] */
+	uint64_t bucket[STATS_BUCKETS];	/* [2^i us, 2^(i+1) us), the first from 0 */
+} AsmemHist_t;
+
+/*
+ * The --trend statistics of one series: a field, or one of the tr*
+ * totals. min[] and max[] are per stretch of time, see AsmemTrends_t.
+ */
+#define TREND_BUCKETS 10
+typedef struct {
+	double ewma;			/* smoothed value */
+	double rate;			/* smoothed growth [per s] */
+	unsigned long last;		/* the previous value */
+	unsigned long min[TREND_BUCKETS], max[TREND_BUCKETS];
+} AsmemTrend_t;
+
+#define trRAM MEMINFO_COUNT		/* used memory, as shown */
+#define trSWAP (MEMINFO_COUNT + 1)	/* used swap */
+#define trALL (MEMINFO_COUNT + 2)	/* what isn't available, swap included */
+#define trCOUNT (MEMINFO_COUNT + 3)
+typedef struct {
+	uint64_t time;			/* of the last sample [ns], 0 before the first */
+	uint64_t bucket[TREND_BUCKETS];	/* the stretch of time each min/max is of, + 1 */
+	AsmemTrend_t series[trCOUNT];
+	double eta;			/* until trALL uses everything up [s], < 0 if it isn't growing */
+} AsmemTrends_t;
+
+// an --alert rule, values are in thousandths of the metric's unit
+typedef struct {
+	char text[32];			/* as given */
+	unsigned metric;		/* al* */
+	bool above;			/* on above limit, rather than below */
+	unsigned long limit;
+	unsigned long clear;		/* where it goes off again */
+} AsmemAlert_t;
+
+// what the --alert-exec helper is sent when a rule flips
+typedef struct {
+	char rule[32];
+	char value[24];			/* formatted, in the metric's unit */
+	char dev[256];			/* the monitor's --dev file */
+	bool on;
+} AsmemAlertMsg_t;
+
+// maps a meminfo key onto a field of AsmemMeminfo_t
+typedef struct {
+	const char *key_p;
+	size_t len;
+	size_t offset;
+} MeminfoKey_t;
+
+// maximum number of glyphs in a number
+#define MAXDIGITS 10
+// number of text fields (the t* defines)
+#define MAXFIELDS 14
+
+// one frame's worth of glyphs and bar segment widths
+typedef struct {
+	signed char glyph[MAXFIELDS][MAXDIGITS];
+	unsigned memBar[3];		/* used, buffers, cache */
+	unsigned swapBar[2];		/* used swap; with --swaps on disk, then in compressed RAM */
+	unsigned memPeak, swapPeak;	/* --trend's markers, 1 + their x, 0 for none */
+} AsmemFrame_t;
+
+typedef unsigned long Pixel;
+
+/*
+ * Where frames are drawn. The blit functions compose a frame, present
+ * gets the part of it that changed (present_p may be NULL).
+ */
+typedef struct {
+	const char *name_p;
+	void (*blitBackground_p) (int x, int y, int w, int h);
+	void (*blitGlyph_p) (int glyph, int x, int y);
+	void (*blitBar_p) (unsigned colour, int x, int y, int w);
+	void (*blitFill_p) (Pixel pixel, int x, int y, int w, int h);
+	void (*blitScroll_p) (int x, int y, int w, int h);
+	void (*present_p) (int x, int y, unsigned w, unsigned h);
+} AsmemBackend_t;
+
+// palette index of pixel x,y in one of the 2 bit per pixel bitmaps of atlas.h
+#define ATLAS_INDEX(bits_p, width, x, y) \
+	(((bits_p)[(y) * (((width) + 3) / 4) + (x) / 4] >> (2 * ((x) % 4))) & 3)
+
 typedef struct {
-	Pixmap pixmap;
-	Pixmap mask;
-	XpmAttributes attributes;
-} XpmIcon_t;
+	Pixmap pixmap;			/* --scale times the size */
+	unsigned width, height;
+	const unsigned char *bits_p;	/* indexed bitmap */
+	Pixel palette[4];		/* its colours */
+} AsmemImage_t;
 
 #endif
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2011  Trevor Woerner
+ *
+ * This software is distributed under GPL. For details see LICENSE file.
+ */
+
+/*
+ * Microbenchmarks for the hot paths, built and run by "make bench":
+ *
+ *	asmem-bench meminfo-fixture ...
+ *
+ * Every fixture is checked against what it has to decode to before it's
+ * timed, and a mismatch fails the run. asmem.c is compiled in so that
+ * its static functions can be called directly. Frames are rendered with
+ * the in-memory backend, so no X server is needed. Allocations made by
+ * asmem's own code are counted by wrapping malloc(), calloc() and
+ * realloc() at link time (see Makefile.am).
+ */
+#define main asmem_main
+#include "asmem.c"
+#undef main
+
+#define BENCH_MIN_NS (NSEC_PER_SEC / 4)	// every benchmark runs at least this long
+#define BENCH_LOOP_NS NSEC_PER_SEC		// length of the paced loop
+#define BENCH_LOOP_HZ 1000			// its sample rate
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t nmemb, size_t size);
+void *__real_realloc (void *ptr_p, size_t size);
+void *__wrap_malloc (size_t size);
+void *__wrap_calloc (size_t nmemb, size_t size);
+void *__wrap_realloc (void *ptr_p, size_t size);
+
+static unsigned long benchAllocs_G = 0;
+static AsmemMeminfo_t benchSample_G[2];
+static unsigned benchTick_G = 0;
+static const char *benchData_pG;
+static size_t benchDataLen_G;
+
+void*
+__wrap_malloc (size_t size)
+{
+	++benchAllocs_G;
+	return __real_malloc (size);
+}
+
+void*
+__wrap_calloc (size_t nmemb, size_t size)
+{
+	++benchAllocs_G;
+	return __real_calloc (nmemb, size);
+}
+
+void*
+__wrap_realloc (void *ptr_p, size_t size)
+{
+	++benchAllocs_G;
+	return __real_realloc (ptr_p, size);
+}
+
+/*
+ * Runs fn once to warm up (first-time allocations and cold caches aren't
+ * the steady state) and then in batches that double in size until a
+ * batch takes at least BENCH_MIN_NS.
+ */
+static void
+bench_run (const char *name_p, void (*fn_p)(void))
+{
+	unsigned long iters, i, allocs;
+	uint64_t start, ns;
+
+	fn_p ();
+	for (iters=1; ; iters*=2) {
+		allocs = benchAllocs_G;
+		start = sched_now ();
+		for (i=0; i<iters; ++i)
+			fn_p ();
+		ns = sched_now () - start;
+		allocs = benchAllocs_G - allocs;
+		if (ns >= BENCH_MIN_NS)
+			break;
+	}
+	printf ("%-36s %10lu ops %12.1f ns/op %8.2f allocs/op\n", name_p, iters,
+		(double)ns / (double)iters, (double)allocs / (double)iters);
+}
+
+/* ------------------------------------------------------------------------- */
+// parser
+/* ------------------------------------------------------------------------- */
+/*
+ * What each fixture has to decode to, worked out from the files by hand:
+ * kB/1000, only spaces skipped before a value, the last of a repeated key.
+ */
+static const struct {
+	const char *name_p;
+	unsigned found;
+	AsmemMeminfo_t info;
+} benchFixtures_G[] = {
+	{"meminfo-2.6.32", 0x3fbf, {.memTotal = 8062, .memFree = 417, .memBuffers = 260, .memCached = 5604, .swapTotal = 4194,
+			.swapFree = 4105, .shmem = 8, .slab = 510, .slabReclaimable = 467, .anonPages = 1103, .anonHugePages = 804}},
+	{"meminfo-4.19", 0x7fff, {.memTotal = 32849, .memFree = 1734, .memBuffers = 1208, .memCached = 20418, .swapTotal = 16777,
+			.swapFree = 16402, .memAvailable = 24181, .shmem = 210, .slab = 2391, .slabReclaimable = 2051, .dirty = 2,
+			.anonPages = 6794}},
+	{"meminfo-6.8", 0x1ffff, {.memTotal = 65536, .memFree = 18220, .memBuffers = 941, .memCached = 31355, .swapTotal = 8388,
+			.swapFree = 8380, .memAvailable = 51203, .shmem = 1131, .slab = 2822, .slabReclaimable = 2180, .dirty = 1,
+			.anonPages = 11236, .anonHugePages = 2260, .zswap = 3, .zswapped = 11}},
+	{"meminfo-node", 0x3, {.memTotal = 16383, .memFree = 8110}},
+	{"meminfo-adversarial", 0x3f, {.memTotal = 9999999999999999ul, .memFree = 99999999, .swapTotal = 18446744073709ul,
+			.swapFree = 18446744073709ul}},
+};
+
+/* a fixture which doesn't decode to what it should isn't worth timing */
+static void
+bench_check (const char *data_p, size_t len)
+{
+	const char *name_p = basename (mon_pG->filename);
+	AsmemMeminfo_t info;
+	unsigned long val, want;
+	unsigned found, i, j;
+
+	for (i=0; i<sizeof (benchFixtures_G) / sizeof (benchFixtures_G[0]); ++i)
+		if (strcmp (benchFixtures_G[i].name_p, name_p) == 0)
+			break;
+	if (i == sizeof (benchFixtures_G) / sizeof (benchFixtures_G[0])) {
+		printf ("asmem-bench: nothing is known about what %s decodes to\n", name_p);
+		exit (1);
+	}
+
+	found = meminfo_decode (data_p, data_p + len, &info);
+	if (found != benchFixtures_G[i].found) {
+		printf ("asmem-bench: %s: found mask 0x%x, expected 0x%x\n", name_p, found, benchFixtures_G[i].found);
+		exit (1);
+	}
+	for (j=0; j<MEMINFO_NKEYS; ++j) {
+		val = *(const unsigned long*)((const char*)&info + meminfoKeys_G[j].offset);
+		want = *(const unsigned long*)((const char*)&benchFixtures_G[i].info + meminfoKeys_G[j].offset);
+		if ((found & 1u << j) && val != want) {
+			printf ("asmem-bench: %s: %s is %lu, expected %lu\n", name_p, meminfoKeys_G[j].key_p, val, want);
+			exit (1);
+		}
+	}
+}
+
+static void
+bench_read (void)
+{
+	if (!read_meminfo ())
+		exit (1);
+}
+
+static void
+bench_decode (void)
+{
+	AsmemMeminfo_t info;
+
+	meminfo_decode (benchData_pG, benchData_pG + benchDataLen_G, &info);
+}
+
+static void
+bench_parser (const char *path_p)
+{
+	char name[FNAMESZ];
+	ssize_t len;
+
+	close_meminfo ();
+	safe_copy (mon_pG->filename, path_p, sizeof (mon_pG->filename));
+	if (!open_meminfo ())
+		exit (1);
+	if ((len = meminfo_snapshot (mon_pG->meminfoFd)) < 0)
+		exit (1);
+	bench_check (meminfoBuf_pG, (size_t)len);
+
+	// pread() and decode, as every sample does
+	snprintf (name, sizeof (name), "read %s", basename (mon_pG->filename));
+	bench_run (name, bench_read);
+
+	// the decoding on its own, from a snapshot taken once
+	if ((len = meminfo_snapshot (mon_pG->meminfoFd)) < 0)
+		exit (1);
+	benchData_pG = meminfoBuf_pG;
+	benchDataLen_G = (size_t)len;
+	snprintf (name, sizeof (name), "decode %s", basename (mon_pG->filename));
+	bench_run (name, bench_decode);
+}
+
+/* ------------------------------------------------------------------------- */
+// renderer
+/* ------------------------------------------------------------------------- */
+/* the colours are the defaults, the frames stay in memory */
+static void
+bench_render_setup (void)
+{
+	x11_initialize_colours ();
+	if (!fb_initialize_memory ())
+		exit (1);
+	backend_pG = &memoryBackend_G;
+
+	// two samples which differ in every field
+	benchSample_G[0] = (AsmemMeminfo_t){.memTotal = 32849, .memFree = 1734, .memBuffers = 1208, .memCached = 20418, .swapTotal = 16777, .swapFree = 16402};
+	benchSample_G[1] = (AsmemMeminfo_t){.memTotal = 32849, .memFree = 9120, .memBuffers = 640, .memCached = 11023, .swapTotal = 16777, .swapFree = 12001};
+}
+
+static void
+bench_draw (void)
+{
+	x11_draw_offscreen_win ();
+	x11_draw_main_win_from_offscreen ();
+}
+
+static void
+bench_draw_full (void)
+{
+	mon_pG->drawnValid = false;
+	bench_draw ();
+}
+
+static void
+bench_draw_same (void)
+{
+	memcpy (&mon_pG->fresh, &benchSample_G[0], sizeof (mon_pG->fresh));
+	bench_draw ();
+}
+
+static void
+bench_draw_changed (void)
+{
+	memcpy (&mon_pG->fresh, &benchSample_G[++benchTick_G & 1], sizeof (mon_pG->fresh));
+	bench_draw ();
+}
+
+static void
+bench_draw_history (void)
+{
+	memcpy (&mon_pG->fresh, &benchSample_G[++benchTick_G & 1], sizeof (mon_pG->fresh));
+	history_push (&mon_pG->fresh);
+	bench_draw ();
+}
+
+static void
+bench_renderer (void)
+{
+	bench_render_setup ();
+	x11_layout ();
+	bench_run ("draw full", bench_draw_full);
+	bench_run ("draw unchanged", bench_draw_same);
+	bench_run ("draw changed", bench_draw_changed);
+
+	history_G = true;
+	x11_layout ();
+	if (!history_initialize ((unsigned)graphW_G))
+		exit (1);
+	mon_pG->drawnValid = false;
+	bench_run ("draw history", bench_draw_history);
+	history_G = false;
+	x11_layout ();
+	mon_pG->drawnValid = false;
+}
+
+/* ------------------------------------------------------------------------- */
+// main loop
+/* ------------------------------------------------------------------------- */
+static void
+bench_update (void)
+{
+	meminfo_update ();
+}
+
+/*
+ * Samples the live /proc/meminfo on BENCH_LOOP_HZ deadlines, the way the
+ * main loop does, and reports how late the ticks were.
+ */
+static void
+bench_paced (void)
+{
+	uint64_t deadline, end, now, work = 0;
+	unsigned long ticks = 0, allocs = benchAllocs_G;
+	struct timespec ts;
+
+	memset (&statsJitter_G, 0, sizeof (statsJitter_G));
+	statsJitter_G.name_p = "tick lateness";
+	schedInterval_G = updateInterval_G = 1000 / BENCH_LOOP_HZ;
+	deadline = sched_next_deadline (0, sched_now ());
+	end = deadline + BENCH_LOOP_NS;
+	while (deadline < end) {
+		ts.tv_sec = (time_t)(deadline / NSEC_PER_SEC);
+		ts.tv_nsec = (long)(deadline % NSEC_PER_SEC);
+		clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		now = sched_now ();
+		stats_record (&statsJitter_G, now - deadline);
+		meminfo_update ();
+		work += sched_now () - now;
+		++ticks;
+		deadline = sched_next_deadline (deadline, sched_now ());
+	}
+	printf ("%-36s %10lu ops %12.1f ns/op %8.2f allocs/op\n", "loop paced 1kHz", ticks,
+		(double)work / (double)ticks, (double)(benchAllocs_G - allocs) / (double)ticks);
+	fflush (stdout);
+	stats_dump_hist (&statsJitter_G);
+}
+
+static void
+bench_shm_publish (void)
+{
+	shm_publish (&benchSample_G[++benchTick_G & 1]);
+}
+
+static void
+bench_shm_read (void)
+{
+	AsmemMeminfo_t info;
+
+	shm_read (&info);
+}
+
+static void
+bench_alert_check (void)
+{
+	memcpy (&mon_pG->fresh, &benchSample_G[++benchTick_G & 1], sizeof (mon_pG->fresh));
+	alert_check ();
+}
+
+/* what the --alert rules add to every sample */
+static void
+bench_alert (void)
+{
+	if (!alert_add ("avail<5%") || !alert_add ("used>90%") || !alert_add ("swap>50%") || !alert_add ("growth>100"))
+		exit (1);
+	bench_run ("alert check", bench_alert_check);
+	alertCnt_G = 0;
+	mon_pG->alertOn = 0;
+}
+
+/* what a subscriber pays per sample instead of bench_read() */
+static void
+bench_shm (void)
+{
+	snprintf (shmFilename_G, sizeof (shmFilename_G), "/tmp/asmem-bench.%d", (int)getpid ());
+	shmPublish_G = true;
+	if (!shm_publisher_open ())
+		exit (1);
+	shmFieldCnt_G = MEMINFO_NKEYS;
+	bench_run ("shm publish", bench_shm_publish);
+	bench_run ("shm read", bench_shm_read);
+	shm_cleanup ();
+	unlink (shmFilename_G);
+	shmFilename_G[0] = 0;
+	shmPublish_G = false;
+}
+
+static void
+bench_rec_append (void)
+{
+	AsmemRecSample_t sample;
+
+	sample.time = ++benchTick_G * (uint64_t)1000;
+	memcpy (&sample.info, &benchSample_G[benchTick_G & 1], sizeof (sample.info));
+	rec_append (&sample);
+}
+
+static void
+bench_rec_push (void)
+{
+	rec_push (&benchSample_G[++benchTick_G & 1]);
+}
+
+static void
+bench_replay (void)
+{
+	if (!rec_replay ())
+		exit (1);
+	output_close ();
+}
+
+/*
+ * What encoding a sample costs the recorder thread, what queueing it
+ * costs the main loop, and decoding a whole (full) --record file.
+ */
+static void
+bench_rec (void)
+{
+	snprintf (recFilename_G, sizeof (recFilename_G), "/tmp/asmem-bench.%d.rec", (int)getpid ());
+	recSize_G = 1;
+	if (!rec_open ())
+		exit (1);
+	// the recorder thread is idle while nothing is pushed
+	bench_run ("rec append", bench_rec_append);
+	bench_run ("rec push", bench_rec_push);
+	rec_cleanup ();
+
+	safe_copy (replayFilename_G, recFilename_G, sizeof (replayFilename_G));
+	safe_copy (outputFilename_G, "/dev/null", sizeof (outputFilename_G));
+	outputBatch_G = UINT_MAX;
+	bench_run ("replay 1 MB to csv", bench_replay);
+	outputFilename_G[0] = 0;
+	outputBatch_G = 1;
+	unlink (recFilename_G);
+	recFilename_G[0] = replayFilename_G[0] = 0;
+}
+
+/* what --trend adds to every sample */
+static void
+bench_trend (void)
+{
+	++benchTick_G;
+	trend_update (&mon_pG->trends, &benchSample_G[benchTick_G & 1], benchTick_G * NSEC_PER_SEC);
+}
+
+/* what --swaps adds to every sample, on whatever swap this machine has */
+static void
+bench_swaps (void)
+{
+	swaps_read (&mon_pG->fresh);
+}
+
+/* what --metrics adds to every sample, scrapes are only a send() */
+static void
+bench_metrics (void)
+{
+	memcpy (&mon_pG->fresh, &benchSample_G[++benchTick_G & 1], sizeof (mon_pG->fresh));
+	metrics_render ();
+}
+
+/* what --top adds to every update, on whatever processes this machine has */
+static void
+bench_top_scan (void)
+{
+	top_scan ();
+}
+
+static void
+bench_top (void)
+{
+	char name[64];
+
+	if (!top_initialize ())
+		exit (1);
+	// the first scan opens every statm file, the ones after only new processes'
+	top_scan ();
+	snprintf (name, sizeof (name), "top scan %u processes", topProcCnt_G);
+	bench_run (name, bench_top_scan);
+	top_cleanup ();
+}
+
+static void
+bench_loop (void)
+{
+	close_meminfo ();
+	safe_copy (mon_pG->filename, PROC_MEM, sizeof (mon_pG->filename));
+	if (!open_meminfo ())
+		exit (1);
+
+	mon_pG->drawnValid = false;
+	bench_run ("loop bars", bench_update);
+
+	history_G = true;
+	x11_layout ();
+	mon_pG->drawnValid = false;
+	bench_run ("loop history", bench_update);
+
+	bench_paced ();
+}
+
+int
+main (int argc, char *argv[])
+{
+	int i;
+
+	set_defaults ();
+	for (i=1; i<argc; ++i)
+		bench_parser (argv[i]);
+	bench_renderer ();
+	bench_shm ();
+	bench_alert ();
+	bench_rec ();
+	bench_run ("trend update", bench_trend);
+	if (!swaps_open ())
+		exit (1);
+	bench_run ("swaps read", bench_swaps);
+	swaps_cleanup ();
+	bench_run ("metrics render", bench_metrics);
+	bench_top ();
+	bench_loop ();
+	return 0;
+}
@@ -0,0 +1,92 @@
+# Copyright (C) 2011  Trevor Woerner
+#
+# This software is distributed under GPL. For details see LICENSE file.
+#
+# Converts XPM images into compact indexed bitmaps at build time:
+#
+#	awk -f xpm2atlas.awk background.xpm alphabet.xpm > atlas.h
+#
+# For each NAME.xpm the output holds NAME_WIDTH, NAME_HEIGHT and nameBits[].
+# Every pixel is a 2 bit index into the image's colours, in the order in
+# which they are listed in the XPM; 4 pixels per byte, first pixel in the
+# lowest bits, each row padded to a whole byte (see ATLAS_INDEX()). The
+# colours themselves are supplied at load time.
+
+function fail(msg) {
+	printf ("%s: %s\n", FILENAME, msg) > "/dev/stderr"
+	failed = 1
+	exit 1
+}
+
+function finish() {
+	if (name == "")
+		return
+	if (row != height)
+		fail("expected " height " rows, got " row)
+	printf ("};\n\n")
+}
+
+BEGIN {
+	printf ("/* generated by xpm2atlas.awk, do not edit */\n\n")
+}
+
+FNR == 1 {
+	finish()
+	name = FILENAME
+	sub (/.*\//, "", name)
+	sub (/\.xpm$/, "", name)
+	state = 0
+	row = 0
+	split ("", index_of)
+}
+
+/^"/ {
+	line = $0
+	sub (/^"/, "", line)
+	sub (/".*$/, "", line)
+
+	if (state == 0) {
+		split (line, field, " ")
+		width = field[1] + 0
+		height = field[2] + 0
+		colours = field[3] + 0
+		if (field[4] != 1)
+			fail("only 1 char per pixel is supported")
+		if (colours > 4)
+			fail("at most 4 colours are supported")
+		printf ("#define %s_WIDTH %d\n", toupper (name), width)
+		printf ("#define %s_HEIGHT %d\n", toupper (name), height)
+		printf ("static const unsigned char %sBits[] = {\n", name)
+		colour = 0
+		state = 1
+		next
+	}
+
+	if (state == 1) {
+		index_of[substr (line, 1, 1)] = colour++
+		if (colour == colours)
+			state = 2
+		next
+	}
+
+	if (length (line) != width)
+		fail("row " row " is not " width " pixels wide")
+	printf ("\t")
+	for (x = 0; x < width; x += 4) {
+		byte = 0
+		for (bit = 0; bit < 4 && x + bit < width; ++bit) {
+			c = substr (line, x + bit + 1, 1)
+			if (!(c in index_of))
+				fail("unknown colour '" c "' in row " row)
+			byte += index_of[c] * (2 ^ (2 * bit))
+		}
+		printf ("0x%02x,", byte)
+	}
+	printf ("\n")
+	++row
+}
+
+END {
+	if (!failed)
+		finish()
+}